@@ -0,0 +1,101 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "../src/multi_pouch.h"
+
+/*
+ * Submits a burst of document GETs to the multi interface, first all at
+ * once and then through pmi_submit() with in-flight limits, where the
+ * producer holds back whenever the queue is full and carries on from the
+ * callbacks of finished requests.
+ *
+ * usage: ./bench_admit [server] [number of requests] [max in flight] [max queued]
+ */
+
+typedef struct {
+	char *server;
+	char *db;
+	int submitted;
+	int finished;
+	int failed;
+	int refused;
+	int peak;
+	int n;
+} Run;
+
+static double now(void){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec/1e9;
+}
+
+// submits requests until they run out or the queue is full
+static void produce(Run *run, PouchMInfo *pmi){
+	while (run->submitted < run->n){
+		PouchReq *pr = doc_get(pr_init(), run->server, run->db, "doc");
+		if (pmi_submit(pr, pmi) == POUCH_QUEUE_FULL){
+			run->refused++;
+			pr_free(pr);
+			return;
+		}
+		run->submitted++;
+		if (pmi->inflight > run->peak)
+			run->peak = pmi->inflight;
+	}
+}
+
+static void done(PouchReq *pr, PouchMInfo *pmi){
+	Run *run = (Run *)pmi->custom;
+	run->finished++;
+	if (pr->curlcode != CURLE_OK || pr->httpresponse != 200)
+		run->failed++;
+	pr_free(pr);
+	produce(run, pmi);
+}
+
+static double run(char *server, char *db, int n, int inflight, int queued){
+	Run r = { server, db, 0, 0, 0, 0, 0, n };
+	PouchMInfo *pmi = pr_mk_pmi_epoll(done, &r);
+	pmi_set_limits(pmi, inflight, inflight, queued);
+	double start = now();
+	produce(&r, pmi);
+	pmi_loop(pmi);
+	double elapsed = now() - start;
+	printf("\t%d failed, at most %d in flight, queue full %d times\n",
+			r.failed + n - r.finished, r.peak, r.refused);
+	pr_del_pmi(pmi);
+	return n/elapsed;
+}
+
+int main(int argc, char* argv[]){
+	char *server = argc > 1 ? argv[1] : "http://127.0.0.1:5984";
+	int n = argc > 2 ? atoi(argv[2]) : 2000;
+	int inflight = argc > 3 ? atoi(argv[3]) : 32;
+	int queued = argc > 4 ? atoi(argv[4]) : 256;
+	char *db = "pouch_bench_admit";
+
+	PouchReq *pr = pr_init();
+	pr = db_create(pr, server, db);
+	pr_do(pr);
+	if (pr->curlcode != CURLE_OK){
+		fprintf(stderr, "could not reach %s: %s\n", server,
+				curl_easy_strerror(pr->curlcode));
+		pr_free(pr);
+		return 1;
+	}
+	pr = doc_create_id(pr, server, db, "doc", "{\"type\":\"bench\",\"value\":42}");
+	pr_do(pr);
+
+	printf("%d document GETs against %s/%s\n", n, server, db);
+	double unlimited = run(server, db, n, 0, 0);
+	printf("\tall at once:                %10.1f req/s\n", unlimited);
+	double limited = run(server, db, n, inflight, queued);
+	printf("\t%3d in flight, %4d queued:  %10.1f req/s\n", inflight, queued, limited);
+
+	pr = db_delete(pr, server, db);
+	pr_do(pr);
+	pr_free(pr);
+	return 0;
+}
@@ -0,0 +1,79 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "../src/pouch.h"
+
+/*
+ * Measures how many document GETs per second pr_do() makes one after
+ * another, and pr_do_batch() makes at a range of concurrency limits.
+ *
+ * usage: ./bench_batch [server] [number of requests]
+ */
+
+static double now(void){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec/1e9;
+}
+
+int main(int argc, char* argv[]){
+	char *server = argc > 1 ? argv[1] : "http://127.0.0.1:5984";
+	int n = argc > 2 ? atoi(argv[2]) : 1000;
+	char *db = "pouch_bench_batch";
+	int concurrency[] = { 1, 2, 4, 8, 16, 32, 64 };
+	int i, c, failed;
+
+	// the share layer keeps connections open from one batch to the next,
+	// so every run starts with warm connections
+	pouch_share_init();
+	PouchReq *pr = pr_init();
+	pr = db_create(pr, server, db);
+	pr_do(pr);
+	if (pr->curlcode != CURLE_OK){
+		fprintf(stderr, "could not reach %s: %s\n", server,
+				curl_easy_strerror(pr->curlcode));
+		pr_free(pr);
+		pouch_share_cleanup();
+		return 1;
+	}
+	pr = doc_create_id(pr, server, db, "doc", "{\"type\":\"bench\",\"value\":42}");
+	pr_do(pr);
+
+	printf("%d document GETs against %s/%s\n", n, server, db);
+	double start = now();
+	for (i = 0; i < n; i++){
+		pr = doc_get(pr, server, db, "doc");
+		pr_do(pr);
+	}
+	double serial = n/(now() - start);
+	printf("\tpr_do() one at a time:     %10.1f req/s\n", serial);
+
+	PouchReq **reqs = calloc(n, sizeof(PouchReq *));
+	for (i = 0; i < n; i++)
+		reqs[i] = pr_init();
+	for (c = 0; c < (int)(sizeof(concurrency)/sizeof(concurrency[0])); c++){
+		for (i = 0; i < n; i++)
+			doc_get(reqs[i], server, db, "doc");
+		start = now();
+		pr_do_batch(reqs, n, concurrency[c]);
+		double rate = n/(now() - start);
+		for (i = failed = 0; i < n; i++)
+			if (reqs[i]->curlcode != CURLE_OK || reqs[i]->httpresponse != 200)
+				failed++;
+		printf("\tpr_do_batch(), %2d at once: %10.1f req/s (%.2fx)\n",
+				concurrency[c], rate, rate/serial);
+		if (failed)
+			fprintf(stderr, "\t%d of %d requests failed\n", failed, n);
+	}
+	for (i = 0; i < n; i++)
+		pr_free(reqs[i]);
+	free(reqs);
+
+	pr = db_delete(pr, server, db);
+	pr_do(pr);
+	pr_free(pr);
+	pouch_share_cleanup();
+	return 0;
+}
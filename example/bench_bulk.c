@@ -0,0 +1,99 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "../src/bulk_pouch.h"
+
+/*
+ * Measures how many documents per second can be written one at a time with
+ * doc_create_id(), and in _bulk_docs batches with a PouchBulk over pr_do()
+ * and over the multi interface.
+ *
+ * usage: ./bench_bulk [server] [number of documents] [batch size]
+ */
+
+static double now(void){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec/1e9;
+}
+
+static void count_result(PouchBulk *pb, void *custom, const char *id, const char *rev, const char *error, const char *reason){
+	if (error)
+		fprintf(stderr, "\t%s: %s (%s)\n", id ? id : "?", error, reason ? reason : "");
+}
+
+static double run_single(char *server, char *db, int n){
+	char id[64];
+	char *data = "{\"type\":\"bench\",\"value\":42}";
+	PouchReq *pr = pr_init();
+	double start = now();
+	int i;
+	for (i = 0; i < n; i++){
+		snprintf(id, sizeof(id), "single-%d", i);
+		pr = doc_create_id(pr, server, db, id, data);
+		pr_do(pr);
+	}
+	double elapsed = now() - start;
+	pr_free(pr);
+	return n/elapsed;
+}
+
+static double run_bulk(char *server, char *db, int n, int batch, int multi){
+	char doc[128];
+	int i;
+	struct event_base *base = multi ? event_base_new() : NULL;
+	PouchMInfo *pmi = multi ? pr_mk_pmi(base, NULL, NULL, NULL) : NULL;
+	PouchBulk *pb = pb_init(server, db, pmi, count_result, NULL);
+	pb_set_thresholds(pb, batch, 0, 0);
+	double start = now();
+	for (i = 0; i < n; i++){
+		snprintf(doc, sizeof(doc), "{\"_id\":\"%s-%d\",\"type\":\"bench\",\"value\":42}",
+				multi ? "multi" : "bulk", i);
+		pb_add(pb, doc, NULL);
+	}
+	pb_flush(pb);
+	if (pmi)
+		event_base_dispatch(base);	// returns once every batch is done
+	double elapsed = now() - start;
+	if (pb->written != n)
+		fprintf(stderr, "\tonly %ld of %d documents written\n", pb->written, n);
+	pb_free(pb);
+	if (pmi)
+		pr_del_pmi(pmi);
+	return n/elapsed;
+}
+
+int main(int argc, char* argv[]){
+	char *server = argc > 1 ? argv[1] : "http://127.0.0.1:5984";
+	int n = argc > 2 ? atoi(argv[2]) : 2000;
+	int batch = argc > 3 ? atoi(argv[3]) : 500;
+	char *db = "pouch_bench_bulk";
+
+	curl_global_init(CURL_GLOBAL_ALL);
+	PouchReq *pr = pr_init();
+	pr = db_create(pr, server, db);
+	pr_do(pr);
+	if (pr->curlcode != CURLE_OK){
+		fprintf(stderr, "could not reach %s: %s\n", server,
+				curl_easy_strerror(pr->curlcode));
+		pr_free(pr);
+		return 1;
+	}
+
+	printf("%d documents against %s/%s, %d per batch\n", n, server, db, batch);
+	double single = run_single(server, db, n);
+	printf("\tdoc_create_id per document: %10.1f docs/s\n", single);
+	double bulk = run_bulk(server, db, n, batch, 0);
+	printf("\tPouchBulk with pr_do():     %10.1f docs/s\n", bulk);
+	double multi = run_bulk(server, db, n, batch, 1);
+	printf("\tPouchBulk with PouchMInfo:  %10.1f docs/s\n", multi);
+	printf("\tspeedup:                    %10.2fx\n", bulk/single);
+
+	pr = db_delete(pr, server, db);
+	pr_do(pr);
+	pr_free(pr);
+	curl_global_cleanup();
+	return 0;
+}
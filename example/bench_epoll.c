@@ -0,0 +1,95 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "../src/multi_pouch.h"
+
+/*
+ * Measures how many document GETs per second the multi interface makes
+ * with the libevent backend and with the epoll backend, keeping the same
+ * number of requests in flight in both.
+ *
+ * usage: ./bench_epoll [server] [number of requests] [requests in flight]
+ */
+
+typedef struct {
+	char *server;
+	char *db;
+	int started;
+	int finished;
+	int failed;
+	int n;
+} Run;
+
+static double now(void){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec/1e9;
+}
+
+// starts the next request from the callback of the one that just finished
+static void done(PouchReq *pr, PouchMInfo *pmi){
+	Run *run = (Run *)pmi->custom;
+	run->finished++;
+	if (pr->curlcode != CURLE_OK || pr->httpresponse != 200)
+		run->failed++;
+	if (run->started < run->n){
+		run->started++;
+		pr_dopmi(doc_get(pr, run->server, run->db, "doc"), pmi);
+	}
+	else
+		pr_free(pr);
+}
+
+static double run(char *server, char *db, int n, int inflight, int epoll){
+	Run r = { server, db, 0, 0, 0, n };
+	struct event_base *base = epoll ? NULL : event_base_new();
+	PouchMInfo *pmi = epoll ? pr_mk_pmi_epoll(done, &r) : pr_mk_pmi(base, NULL, done, &r);
+	int i;
+	double start = now();
+	for (i = 0; i < inflight && r.started < n; i++){
+		r.started++;
+		pr_dopmi(doc_get(pr_init(), server, db, "doc"), pmi);
+	}
+	if (epoll)
+		pmi_loop(pmi);
+	else
+		event_base_dispatch(base);	// returns once every request is done
+	double elapsed = now() - start;
+	if (r.failed || r.finished != n)
+		fprintf(stderr, "\t%d of %d requests failed\n", r.failed + n - r.finished, n);
+	pr_del_pmi(pmi);
+	return n/elapsed;
+}
+
+int main(int argc, char* argv[]){
+	char *server = argc > 1 ? argv[1] : "http://127.0.0.1:5984";
+	int n = argc > 2 ? atoi(argv[2]) : 5000;
+	int inflight = argc > 3 ? atoi(argv[3]) : 16;
+	char *db = "pouch_bench_epoll";
+
+	PouchReq *pr = pr_init();
+	pr = db_create(pr, server, db);
+	pr_do(pr);
+	if (pr->curlcode != CURLE_OK){
+		fprintf(stderr, "could not reach %s: %s\n", server,
+				curl_easy_strerror(pr->curlcode));
+		pr_free(pr);
+		return 1;
+	}
+	pr = doc_create_id(pr, server, db, "doc", "{\"type\":\"bench\",\"value\":42}");
+	pr_do(pr);
+
+	printf("%d document GETs against %s/%s, %d in flight\n", n, server, db, inflight);
+	double libevent = run(server, db, n, inflight, 0);
+	printf("\tlibevent backend: %10.1f req/s\n", libevent);
+	double epoll = run(server, db, n, inflight, 1);
+	printf("\tepoll backend:    %10.1f req/s\n", epoll);
+	printf("\tspeedup:          %10.2fx\n", epoll/libevent);
+
+	pr = db_delete(pr, server, db);
+	pr_do(pr);
+	pr_free(pr);
+	return 0;
+}
@@ -0,0 +1,80 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "../src/exec_pouch.h"
+
+/*
+ * Measures how many document GETs per second plain synchronous code gets
+ * with pr_do() one after another, and when the same requests are submitted
+ * to a PouchExec and waited for.
+ *
+ * usage: ./bench_exec [server] [number of requests] [threads]
+ */
+
+static double now(void){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec/1e9;
+}
+
+int main(int argc, char* argv[]){
+	char *server = argc > 1 ? argv[1] : "http://127.0.0.1:5984";
+	int n = argc > 2 ? atoi(argv[2]) : 2000;
+	int threads = argc > 3 ? atoi(argv[3]) : POUCH_EXEC_THREADS;
+	char *db = "pouch_bench_exec";
+	int i, failed = 0;
+
+	PouchReq *pr = pr_init();
+	pr = db_create(pr, server, db);
+	pr_do(pr);
+	if (pr->curlcode != CURLE_OK){
+		fprintf(stderr, "could not reach %s: %s\n", server,
+				curl_easy_strerror(pr->curlcode));
+		pr_free(pr);
+		return 1;
+	}
+	pr = doc_create_id(pr, server, db, "doc", "{\"type\":\"bench\",\"value\":42}");
+	pr_do(pr);
+
+	printf("%d document GETs against %s/%s\n", n, server, db);
+	double start = now();
+	for (i = 0; i < n; i++){
+		pr = doc_get(pr, server, db, "doc");
+		pr_do(pr);
+	}
+	double serial = n/(now() - start);
+	printf("\tpr_do() one at a time: %10.1f req/s\n", serial);
+
+	// fresh PouchReqs on the workers find warm connections in the share layer
+	pouch_share_init();
+	PouchExec *pe = pe_init(threads);
+	PouchReq **prs = calloc(n, sizeof(PouchReq *));
+	PouchFuture **futs = calloc(n, sizeof(PouchFuture *));
+	start = now();
+	for (i = 0; i < n; i++){
+		prs[i] = doc_get(pr_init(), server, db, "doc");
+		futs[i] = pe_submit(pe, prs[i]);
+	}
+	for (i = 0; i < n; i++){
+		if (pe_wait(futs[i])->httpresponse != 200)
+			failed++;
+		pe_future_free(futs[i]);
+		pr_free(prs[i]);
+	}
+	double pooled = n/(now() - start);
+	printf("\tPouchExec, %2d threads: %10.1f req/s\n", pe->n_threads, pooled);
+	printf("\tspeedup:               %10.2fx\n", pooled/serial);
+	if (failed)
+		fprintf(stderr, "\t%d of %d requests failed\n", failed, n);
+	pe_free(pe);
+	free(prs);
+	free(futs);
+
+	pr = db_delete(pr, server, db);
+	pr_do(pr);
+	pr_free(pr);
+	pouch_share_cleanup();
+	return 0;
+}
@@ -0,0 +1,109 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "../src/bulk_pouch.h"
+#include "../src/fetch_pouch.h"
+
+/*
+ * Measures how many documents per second can be read with one doc_get()
+ * per id, and with a PouchFetch over pr_do() and over the multi interface.
+ *
+ * usage: ./bench_fetch [server] [number of documents] [chunk size]
+ */
+
+static double now(void){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec/1e9;
+}
+
+static void got_doc(PouchFetch *pf, const char *id, const char *json, size_t len, const char *error){
+	if (error)
+		fprintf(stderr, "\t%s: %s\n", id, error);
+}
+
+static double run_single(char *server, char *db, char **ids, int n){
+	PouchReq *pr = pr_init();
+	int i, failed = 0;
+	double start = now();
+	for (i = 0; i < n; i++){
+		pr = doc_get(pr, server, db, ids[i]);
+		pr_do(pr);
+		if (pr->httpresponse != 200)
+			failed++;
+	}
+	double elapsed = now() - start;
+	if (failed)
+		fprintf(stderr, "\t%d of %d documents failed\n", failed, n);
+	pr_free(pr);
+	return n/elapsed;
+}
+
+static double run_fetch(char *server, char *db, char **ids, int n, int chunk, int multi){
+	struct event_base *base = multi ? event_base_new() : NULL;
+	PouchMInfo *pmi = multi ? pr_mk_pmi(base, NULL, NULL, NULL) : NULL;
+	PouchFetch *pf = pf_init(server, db, pmi, got_doc, NULL);
+	pf_set_options(pf, chunk, 1);
+	double start = now();
+	pf_get(pf, ids, NULL, n);
+	if (pmi)
+		event_base_dispatch(base);	// returns once every chunk is done
+	double elapsed = now() - start;
+	if (pf->fetched != n)
+		fprintf(stderr, "\tonly %ld of %d documents fetched\n", pf->fetched, n);
+	pf_free(pf);
+	if (pmi)
+		pr_del_pmi(pmi);
+	return n/elapsed;
+}
+
+int main(int argc, char* argv[]){
+	char *server = argc > 1 ? argv[1] : "http://127.0.0.1:5984";
+	int n = argc > 2 ? atoi(argv[2]) : 2000;
+	int chunk = argc > 3 ? atoi(argv[3]) : 500;
+	char *db = "pouch_bench_fetch";
+	char doc[128];
+	int i;
+
+	curl_global_init(CURL_GLOBAL_ALL);
+	PouchReq *pr = pr_init();
+	pr = db_create(pr, server, db);
+	pr_do(pr);
+	if (pr->curlcode != CURLE_OK){
+		fprintf(stderr, "could not reach %s: %s\n", server,
+				curl_easy_strerror(pr->curlcode));
+		pr_free(pr);
+		return 1;
+	}
+
+	// fill the database
+	char **ids = (char **)malloc(n*sizeof(char *));
+	PouchBulk *pb = pb_init(server, db, NULL, NULL, NULL);
+	for (i = 0; i < n; i++){
+		ids[i] = (char *)malloc(32);
+		snprintf(ids[i], 32, "doc-%d", i);
+		snprintf(doc, sizeof(doc), "{\"_id\":\"%s\",\"type\":\"bench\",\"value\":%d}", ids[i], i);
+		pb_add(pb, doc, NULL);
+	}
+	pb_free(pb);
+
+	printf("%d documents from %s/%s, %d per chunk\n", n, server, db, chunk);
+	double single = run_single(server, db, ids, n);
+	printf("\tdoc_get per document:       %10.1f docs/s\n", single);
+	double fetch = run_fetch(server, db, ids, n, chunk, 0);
+	printf("\tPouchFetch with pr_do():    %10.1f docs/s\n", fetch);
+	double multi = run_fetch(server, db, ids, n, chunk, 1);
+	printf("\tPouchFetch with PouchMInfo: %10.1f docs/s\n", multi);
+	printf("\tspeedup:                    %10.2fx\n", multi/single);
+
+	for (i = 0; i < n; i++)
+		free(ids[i]);
+	free(ids);
+	pr = db_delete(pr, server, db);
+	pr_do(pr);
+	pr_free(pr);
+	curl_global_cleanup();
+	return 0;
+}
@@ -0,0 +1,125 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "../src/pouch.h"
+
+/*
+ * Measures what compression costs and saves: bytes on the wire and time per
+ * request for a _bulk_docs upload with and without a gzip request body, and
+ * for an _all_docs?include_docs=true download with and without
+ * Accept-Encoding. The server must compress responses for the second part
+ * to show a difference (CouchDB itself doesn't; a proxy in front of it, or
+ * Cloudant, does).
+ *
+ * usage: ./bench_gzip [server] [documents per request] [rounds]
+ */
+
+static double now(void){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec/1e9;
+}
+
+// a _bulk_docs body of n documents as repetitive as real monitoring data
+static char *make_batch(int n, int round, size_t *len){
+	size_t alloc = 64 + (size_t)n*160;
+	char *body = malloc(alloc);
+	size_t off = 0;
+	int i;
+	off += sprintf(body, "{\"docs\":[");
+	for (i = 0; i < n; i++){
+		off += snprintf(body + off, alloc - off,
+				"%s{\"_id\":\"r%d-%06d\",\"type\":\"reading\",\"channel\":%d,\"crate\":%d,\"value\":%d.%03d,\"status\":\"ok\"}",
+				i ? "," : "", round, i, i % 512, i % 19, i % 1000, (i*7) % 1000);
+	}
+	off += snprintf(body + off, alloc - off, "]}");
+	*len = off;
+	return body;
+}
+
+static void run_upload(char *server, char *db, int n, int rounds, size_t threshold, int offset){
+	PouchReq *pr = pr_init();
+	curl_off_t wire = 0;
+	size_t raw = 0, len;
+	double elapsed = 0;
+	int r;
+	pouch_compression(1, threshold);
+	for (r = 0; r < rounds; r++){
+		char *body = make_batch(n, offset + r, &len);
+		raw += len;
+		pr_set_method(pr, POST);
+		pr_set_url(pr, server);
+		pr->url = combine(&(pr->url), pr->url, db, "/");
+		pr->url = combine(&(pr->url), pr->url, "_bulk_docs", "/");
+		pr_set_prdata(pr, body, len);
+		double start = now();
+		pr_do(pr);
+		elapsed += now() - start;
+		if (pr->httpresponse != 201)
+			fprintf(stderr, "\t_bulk_docs failed: %ld\n", pr->httpresponse);
+		curl_off_t sent = 0;
+		curl_easy_getinfo(pr->easy, CURLINFO_SIZE_UPLOAD_T, &sent);
+		wire += sent;
+	}
+	printf("\t%-22s %10zu bytes -> %10lld on the wire, %8.2f ms/request\n",
+			threshold ? "gzip request bodies:" : "plain request bodies:",
+			raw, (long long)wire, 1000*elapsed/rounds);
+	pr_free(pr);
+}
+
+static void run_download(char *server, char *db, int rounds, int accept){
+	PouchReq *pr = pr_init();
+	curl_off_t wire = 0;
+	size_t raw = 0;
+	double elapsed = 0;
+	int r;
+	pouch_compression(accept, 0);
+	for (r = 0; r < rounds; r++){
+		pr = get_all_docs(pr, server, db);
+		pr_add_param(pr, "include_docs", "true");
+		double start = now();
+		pr_do(pr);
+		elapsed += now() - start;
+		curl_off_t got = 0;
+		curl_easy_getinfo(pr->easy, CURLINFO_SIZE_DOWNLOAD_T, &got);
+		wire += got;
+		raw += pr->resp.size;
+	}
+	printf("\t%-22s %10zu bytes <- %10lld on the wire, %8.2f ms/request\n",
+			accept ? "Accept-Encoding:" : "no Accept-Encoding:",
+			raw, (long long)wire, 1000*elapsed/rounds);
+	pr_free(pr);
+}
+
+int main(int argc, char* argv[]){
+	char *server = argc > 1 ? argv[1] : "http://127.0.0.1:5984";
+	int n = argc > 2 ? atoi(argv[2]) : 2000;
+	int rounds = argc > 3 ? atoi(argv[3]) : 5;
+	char *db = "pouch_bench_gzip";
+
+	curl_global_init(CURL_GLOBAL_ALL);
+	PouchReq *pr = pr_init();
+	pr = db_create(pr, server, db);
+	pr_do(pr);
+	if (pr->curlcode != CURLE_OK){
+		fprintf(stderr, "could not reach %s: %s\n", server,
+				curl_easy_strerror(pr->curlcode));
+		pr_free(pr);
+		return 1;
+	}
+
+	printf("%d rounds of %d documents against %s/%s\n", rounds, n, server, db);
+	run_upload(server, db, n, rounds, 0, 0);
+	run_upload(server, db, n, rounds, 1024, rounds);
+	run_download(server, db, rounds, 0);
+	run_download(server, db, rounds, 1);
+
+	pouch_compression(1, 0);
+	pr = db_delete(pr, server, db);
+	pr_do(pr);
+	pr_free(pr);
+	curl_global_cleanup();
+	return 0;
+}
@@ -0,0 +1,80 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "../src/pouch.h"
+
+/*
+ * Measures how many small document PUTs per second pr_do() can make when
+ * every request uses a fresh PouchReq (a new connection each time) versus
+ * when one PouchReq is reused (the connection is kept alive), and finally
+ * with fresh PouchReqs that all use the process-wide share layer.
+ *
+ * usage: ./bench_keepalive [server] [number of requests]
+ */
+
+static double now(void){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec/1e9;
+}
+
+static double run(char *server, char *db, int n, int reuse, char *prefix){
+	char id[64];
+	char *data = "{\"type\":\"bench\",\"value\":42}";
+	PouchReq *pr = reuse ? pr_init() : NULL;
+	int i, failed = 0;
+	double start = now();
+	for (i = 0; i < n; i++){
+		if (!reuse)
+			pr = pr_init();
+		snprintf(id, sizeof(id), "%s-%d", prefix, i);
+		pr = doc_create_id(pr, server, db, id, data);
+		pr_do(pr);
+		if (pr->curlcode != CURLE_OK || pr->httpresponse != 201)
+			failed++;
+		if (!reuse)
+			pr_free(pr);
+	}
+	double elapsed = now() - start;
+	if (reuse)
+		pr_free(pr);
+	if (failed)
+		fprintf(stderr, "\t%d of %d requests failed\n", failed, n);
+	return n/elapsed;
+}
+
+int main(int argc, char* argv[]){
+	char *server = argc > 1 ? argv[1] : "http://127.0.0.1:5984";
+	int n = argc > 2 ? atoi(argv[2]) : 1000;
+	char *db = "pouch_bench_keepalive";
+
+	PouchReq *pr = pr_init();
+	pr = db_create(pr, server, db);
+	pr_do(pr);
+	if (pr->curlcode != CURLE_OK){
+		fprintf(stderr, "could not reach %s: %s\n", server,
+				curl_easy_strerror(pr->curlcode));
+		pr_free(pr);
+		return 1;
+	}
+
+	printf("%d document PUTs against %s/%s\n", n, server, db);
+	double cold = run(server, db, n, 0, "cold");
+	printf("\tnew PouchReq per request: %10.1f req/s\n", cold);
+	double warm = run(server, db, n, 1, "warm");
+	printf("\treused PouchReq:          %10.1f req/s\n", warm);
+	printf("\tspeedup:                  %10.2fx\n", warm/cold);
+
+	// with the share layer, even a fresh PouchReq finds a warm connection
+	pouch_share_init();
+	double shared = run(server, db, n, 0, "shared");
+	printf("\tnew PouchReq, shared cache:%9.1f req/s\n", shared);
+
+	pr = db_delete(pr, server, db);
+	pr_do(pr);
+	pr_free(pr);
+	pouch_share_cleanup();
+	return 0;
+}
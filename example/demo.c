@@ -3,8 +3,30 @@
 #include <string.h>
 
 #include "../src/pouch.h"
+#include "../src/bulk_pouch.h"
 #include "lib/json.h"
 
+// sink that feeds a response into a JsonStream while it downloads
+static size_t stream_to_json(PouchReq *pr, char *data, size_t len, void *userp){
+	return json_stream_feed((JsonStream *)userp, data, len) ? len : 0;
+}
+
+// prints the id of each row of an _all_docs response as it is parsed
+static bool print_row(JsonStream *js, JsonEvent ev, const char *key, int depth, JsonNode *row, void *userdata){
+	if (ev == JSON_EV_VALUE && depth == 2)
+		printf("\t%s\n", json_get_string(json_find_member(row, "id")));
+	json_delete(row);
+	return true;
+}
+
+// prints the result of deleting each document
+static void print_deleted(PouchBulk *pb, void *custom, const char *id, const char *rev, const char *error, const char *reason){
+	if (!error)
+		printf("\tDeleted \"%s\"\t(rev= %s )\n", id, rev);
+	else
+		printf("Unable to delete \"%s\": %s (%s)\n", id ? id : "?", error, reason ? reason : "");
+}
+
 int main(int argc, char* argv[]){
 	//define strings for connecting to the database
 	char *server = "snoplus.cloudant.com";
@@ -158,6 +180,16 @@ int main(int argc, char* argv[]){
 	//get all docs
 	pr = get_all_docs(pr, server, newdb);
 	pr_do(pr);
+
+	//get all docs again, parsing each row as soon as it arrives
+	printf("Documents in %s\n", newdb);
+	JsonStream *js = json_stream_new(2, print_row, NULL);
+	pr = pr_set_sink(pr, stream_to_json, js);
+	pr = get_all_docs(pr, server, newdb);
+	pr_do(pr);
+	json_stream_finish(js);
+	json_stream_delete(js);
+	pr = pr_set_sink(pr, NULL, NULL);
 	
 	
 	printf("Finished creating some documents.\n");
@@ -171,38 +203,13 @@ int main(int argc, char* argv[]){
 	
 	free(rev); // all done with this revision
 
-	// Delete all the documents on newdb
-	pr = get_all_docs(pr, server, newdb);
-	pr_do(pr);
-
-	JsonNode *response = json_decode(pr->resp.data);
-	JsonNode *all_docs = json_find_member(response, "rows");
+	// Delete all the documents on newdb, a _bulk_docs batch at a time
 	printf("Deleting all docs on %s/%s\n", server, newdb);
-	JsonNode *doc, *del_resp;
-	char *_rev;
-	json_foreach(doc, all_docs){
-		char *id = json_get_string(json_find_member(doc, "id")); // get the doc's id
-		
-		_rev = doc_get_cur_rev(pr, server, newdb, id); // get the doc's revision
-		
-		pr = doc_delete(pr, server, newdb, id, _rev); // delete the doc
-		pr_do(pr);
-
-		del_resp = json_decode(pr->resp.data); // check the response
-		bool ok = json_get_bool(json_find_member(del_resp, "ok"));
-		if (ok)
-			printf("\tDeleted \"%s\"\t(rev= %s )\n", id, _rev);
-		else {
-			printf("Unable to delete \"%s\"\t(rev= %s )\n", id, _rev);
-			printf("server returned: %s\n", pr->resp.data);
-		}
-		// clean up
-		json_delete(del_resp);
-		free(_rev);
-	}
-
-	json_delete(doc);
-	json_delete(response);
+	long deleted = pb_delete_all(server, newdb, 0, 0, print_deleted, NULL);
+	if (deleted < 0)
+		printf("Unable to list the docs on %s/%s\n", server, newdb);
+	else
+		printf("Deleted %ld docs\n", deleted);
 
 	//cleanup
 	pr_free(pr);
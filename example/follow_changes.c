@@ -0,0 +1,64 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <signal.h>
+
+#include "../src/changes_pouch.h"
+
+/*
+ * Follows the _changes feed of a database and prints every change as it
+ * arrives. The last seq is saved in a checkpoint file, so running it again
+ * only prints changes made since it was stopped.
+ *
+ * usage: ./follow_changes [server] [db] [longpoll|continuous] [checkpoint file] [max changes]
+ */
+
+static int seen = 0;
+static int max = 0;
+
+static void print_change(PouchChanges *pc, const char *seq, const char *id, const char *json, size_t len){
+	printf("%s\t%s\n", seq, id);
+	if (max && ++seen >= max){
+		pc_stop(pc);
+		event_base_loopbreak(pc->pmi->base);
+	}
+}
+
+static void on_signal(int fd, short kind, void *userp){
+	PouchChanges *pc = (PouchChanges *)userp;
+	pc_stop(pc);
+	event_base_loopbreak(pc->pmi->base);
+}
+
+int main(int argc, char* argv[]){
+	char *server = argc > 1 ? argv[1] : "http://127.0.0.1:5984";
+	char *db = argc > 2 ? argv[2] : "example_db";
+	int feed = (argc > 3 && !strcmp(argv[3], "continuous")) ?
+		POUCH_FEED_CONTINUOUS : POUCH_FEED_LONGPOLL;
+	char *checkpoint = argc > 4 ? argv[4] : "follow_changes.seq";
+	max = argc > 5 ? atoi(argv[5]) : 0;
+
+	curl_global_init(CURL_GLOBAL_ALL);
+	struct event_base *base = event_base_new();
+	PouchMInfo *pmi = pr_mk_pmi(base, NULL, NULL, NULL);
+
+	PouchChanges *pc = pc_init(pmi, server, db, feed, print_change, NULL);
+	pc_set_checkpoint(pc, checkpoint);
+	pc_set_options(pc, 10000, 0, 0);
+	if (pc->since)
+		fprintf(stderr, "resuming %s/%s from %s\n", server, db, pc->since);
+
+	struct event sigint;
+	evsignal_set(&sigint, SIGINT, on_signal, pc);
+	event_base_set(base, &sigint);
+	evsignal_add(&sigint, NULL);
+
+	pc_start(pc);
+	event_base_dispatch(base);
+
+	evsignal_del(&sigint);
+	pc_free(pc);
+	pr_del_pmi(pmi);
+	curl_global_cleanup();
+	return 0;
+}
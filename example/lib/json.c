@@ -1379,6 +1379,292 @@ return true;
 
 #undef problem
 }
+
+/*** Incremental (push) parsing ***/
+
+typedef enum {
+    JS_VALUE,   /* expecting a value */
+    JS_KEY,     /* expecting a member name (or '}' right after '{') */
+    JS_COLON,   /* expecting ':' */
+    JS_COMMA,   /* expecting ',' or the end of the container */
+    JS_STRING,  /* inside a string: a member name or a scalar value */
+    JS_LITERAL, /* inside a number, true, false or null */
+    JS_CAPTURE, /* inside an object or array at emit_depth */
+} JsonStreamState;
+
+typedef struct
+{
+    char type;  /* '{' or '[' */
+    char *key;  /* name of the current member (objects only) */
+} JsonStreamLevel;
+
+struct JsonStream
+{
+    JsonStreamCallback cb;
+    void *userdata;
+    int emit_depth;
+
+    JsonStreamState state;
+    bool first;         /* just after '{' or '[' */
+    bool is_key;        /* the string being read is a member name */
+    bool in_string;     /* JS_CAPTURE: inside a string */
+    bool escape;        /* the previous character was a backslash */
+    int nest;           /* JS_CAPTURE: nesting level inside the value */
+    bool failed;
+    int documents;      /* complete top-level values seen */
+
+    SB tok;             /* text of the current token or captured value */
+    JsonStreamLevel *stack;
+    int depth;
+    int alloc;
+};
+
+JsonStream *json_stream_new(int emit_depth, JsonStreamCallback cb, void *userdata)
+{
+    JsonStream *js = (JsonStream*) calloc(1, sizeof(JsonStream));
+    if (js == NULL)
+        out_of_memory();
+    js->cb = cb;
+    js->userdata = userdata;
+    js->emit_depth = emit_depth;
+    js->state = JS_VALUE;
+    sb_init(&js->tok);
+    return js;
+}
+
+void json_stream_delete(JsonStream *js)
+{
+    if (js == NULL)
+        return;
+    while (js->depth > 0)
+        free(js->stack[--js->depth].key);
+    free(js->stack);
+    sb_free(&js->tok);
+    free(js);
+}
+
+/* Name of the member the next value belongs to, or NULL inside an array. */
+static const char *stream_key(JsonStream *js)
+{
+    if (js->depth > 0 && js->stack[js->depth - 1].type == '{')
+        return js->stack[js->depth - 1].key;
+    return NULL;
+}
+
+static bool stream_emit(JsonStream *js, JsonEvent ev, JsonNode *node)
+{
+    if (!js->cb(js, ev, stream_key(js), js->depth, node, js->userdata))
+        js->failed = true;
+    return !js->failed;
+}
+
+/* Called after a value ends: either the document is done, or the
+ * container it was in continues. */
+static void stream_after_value(JsonStream *js)
+{
+    js->first = false;
+    if (js->depth == 0) {
+        js->documents++;
+        js->state = JS_VALUE; /* allow another top-level value */
+    } else {
+        js->state = JS_COMMA;
+    }
+}
+
+/* Parse the finished token in js->tok with parse_value/parse_string. */
+static bool stream_finish_token(JsonStream *js)
+{
+    const char *s = sb_finish(&js->tok);
+    JsonNode *node = NULL;
+    char *key;
+
+    js->tok.cur = js->tok.start;
+    if (js->is_key) {
+        if (!parse_string(&s, &key) || *s != 0)
+            return false;
+        free(js->stack[js->depth - 1].key);
+        js->stack[js->depth - 1].key = key;
+        js->state = JS_COLON;
+        return true;
+    }
+    if (!parse_value(&s, &node) || *s != 0)
+        return false;
+    if (!stream_emit(js, JSON_EV_VALUE, node))
+        return false;
+    stream_after_value(js);
+    return true;
+}
+
+static bool stream_push(JsonStream *js, char type)
+{
+    if (!stream_emit(js, type == '{' ? JSON_EV_BEGIN_OBJECT : JSON_EV_BEGIN_ARRAY, NULL))
+        return false;
+    if (js->depth == js->alloc) {
+        js->alloc = js->alloc ? js->alloc * 2 : 8;
+        js->stack = (JsonStreamLevel*) realloc(js->stack, js->alloc * sizeof(JsonStreamLevel));
+        if (js->stack == NULL)
+            out_of_memory();
+    }
+    js->stack[js->depth].type = type;
+    js->stack[js->depth].key = NULL;
+    js->depth++;
+    js->first = true;
+    js->state = type == '{' ? JS_KEY : JS_VALUE;
+    return true;
+}
+
+static bool stream_pop(JsonStream *js, char type)
+{
+    if (js->depth == 0 || js->stack[js->depth - 1].type != type)
+        return false;
+    js->depth--;
+    free(js->stack[js->depth].key);
+    if (!stream_emit(js, type == '{' ? JSON_EV_END_OBJECT : JSON_EV_END_ARRAY, NULL))
+        return false;
+    stream_after_value(js);
+    return true;
+}
+
+/* Start reading the value that begins with c. */
+static bool stream_begin_value(JsonStream *js, char c)
+{
+    if (c == '{' || c == '[') {
+        if (js->depth >= js->emit_depth) {
+            /* collect the whole value and hand it over as one tree */
+            sb_putc(&js->tok, c);
+            js->nest = 1;
+            js->in_string = false;
+            js->escape = false;
+            js->state = JS_CAPTURE;
+            return true;
+        }
+        return stream_push(js, c);
+    }
+    sb_putc(&js->tok, c);
+    js->is_key = false;
+    js->escape = false;
+    js->state = c == '"' ? JS_STRING : JS_LITERAL;
+    return true;
+}
+
+bool json_stream_feed(JsonStream *js, const char *buf, size_t len)
+{
+    const char *end = buf + len;
+    const char *s = buf;
+
+    while (s < end && !js->failed) {
+        char c = *s;
+
+        if (c == 0) {
+            js->failed = true; /* NUL is never valid JSON */
+            break;
+        }
+        switch (js->state) {
+            case JS_VALUE:
+                if (is_space(c))
+                    break;
+                if (c == ']' && js->first && js->depth > 0) {
+                    js->failed = !stream_pop(js, '[');
+                    break;
+                }
+                js->failed = !stream_begin_value(js, c);
+                break;
+
+            case JS_KEY:
+                if (is_space(c))
+                    break;
+                if (c == '}' && js->first) {
+                    js->failed = !stream_pop(js, '{');
+                } else if (c == '"') {
+                    sb_putc(&js->tok, c);
+                    js->is_key = true;
+                    js->escape = false;
+                    js->state = JS_STRING;
+                } else {
+                    js->failed = true;
+                }
+                break;
+
+            case JS_COLON:
+                if (is_space(c))
+                    break;
+                if (c == ':') {
+                    js->first = false;
+                    js->state = JS_VALUE;
+                } else {
+                    js->failed = true;
+                }
+                break;
+
+            case JS_COMMA:
+                if (is_space(c))
+                    break;
+                if (c == ',') {
+                    js->first = false;
+                    js->state = js->stack[js->depth - 1].type == '{' ? JS_KEY : JS_VALUE;
+                } else if (c == '}' || c == ']') {
+                    js->failed = !stream_pop(js, c == '}' ? '{' : '[');
+                } else {
+                    js->failed = true;
+                }
+                break;
+
+            case JS_STRING:
+                sb_putc(&js->tok, c);
+                if (js->escape)
+                    js->escape = false;
+                else if (c == '\\')
+                    js->escape = true;
+                else if (c == '"')
+                    js->failed = !stream_finish_token(js);
+                break;
+
+            case JS_LITERAL:
+                if (is_digit(c) || (c >= 'a' && c <= 'z') || c == '-' || c == '+' || c == '.' || c == 'E') {
+                    sb_putc(&js->tok, c);
+                    break;
+                }
+                /* the character after a literal belongs to what follows it */
+                js->failed = !stream_finish_token(js);
+                continue;
+
+            case JS_CAPTURE:
+                sb_putc(&js->tok, c);
+                if (js->in_string) {
+                    if (js->escape)
+                        js->escape = false;
+                    else if (c == '\\')
+                        js->escape = true;
+                    else if (c == '"')
+                        js->in_string = false;
+                } else if (c == '"') {
+                    js->in_string = true;
+                } else if (c == '{' || c == '[') {
+                    js->nest++;
+                } else if ((c == '}' || c == ']') && --js->nest == 0) {
+                    JsonNode *node = json_decode(sb_finish(&js->tok));
+                    js->tok.cur = js->tok.start;
+                    if (node == NULL || !stream_emit(js, JSON_EV_VALUE, node)) {
+                        js->failed = true;
+                        break;
+                    }
+                    stream_after_value(js);
+                }
+                break;
+        }
+        s++;
+    }
+    return !js->failed;
+}
+
+bool json_stream_finish(JsonStream *js)
+{
+    /* a top-level number or literal only ends with the input */
+    if (!js->failed && js->state == JS_LITERAL && js->depth == 0)
+        js->failed = !stream_finish_token(js);
+    return !js->failed && js->state == JS_VALUE && js->depth == 0
+        && js->tok.cur == js->tok.start && js->documents > 0;
+}
 double json_get_number(JsonNode *node){
     if (node && node->tag == JSON_NUMBER){
         return node->number_;
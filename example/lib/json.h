@@ -77,6 +77,48 @@ void        json_delete         (JsonNode *node);
 
 bool        json_validate       (const char *json);
 
+/*** Incremental (push) parsing ***/
+
+/*
+ * A JsonStream parses JSON that arrives in pieces, such as a CouchDB response
+ * that is still downloading, and reports what it finds through a callback:
+ *
+ *  - objects and arrays nested less deeply than emit_depth produce
+ *    JSON_EV_BEGIN_* and JSON_EV_END_* events,
+ *  - anything at emit_depth or deeper is collected and passed whole as a
+ *    JSON_EV_VALUE, as are scalars at any depth.
+ *
+ * The top-level value has depth 0. For example, with emit_depth 2 each element
+ * of the "rows" array of an _all_docs or view response arrives as one
+ * JSON_EV_VALUE with depth 2, while "total_rows" arrives as a JSON_EV_VALUE
+ * with depth 1 and key "total_rows". With emit_depth 0, every top-level value
+ * arrives whole, which suits newline-separated output such as a continuous
+ * _changes feed (several top-level values in a row are allowed).
+ */
+typedef enum {
+    JSON_EV_BEGIN_OBJECT,
+    JSON_EV_END_OBJECT,
+    JSON_EV_BEGIN_ARRAY,
+    JSON_EV_END_ARRAY,
+    JSON_EV_VALUE,
+} JsonEvent;
+
+typedef struct JsonStream JsonStream;
+
+/*
+ * key is the member name of the value (NULL for array elements and top-level
+ * values) and depth is its nesting depth. For JSON_EV_VALUE, node is the
+ * value and belongs to the callback, which must json_delete() it. Return false
+ * to stop parsing.
+ */
+typedef bool (*JsonStreamCallback)(JsonStream *js, JsonEvent event, const char *key,
+                                   int depth, JsonNode *node, void *userdata);
+
+JsonStream *json_stream_new     (int emit_depth, JsonStreamCallback cb, void *userdata);
+bool        json_stream_feed    (JsonStream *js, const char *buf, size_t len);
+bool        json_stream_finish  (JsonStream *js);
+void        json_stream_delete  (JsonStream *js);
+
 /*** Lookup and traversal ***/
 
 JsonNode   *json_find_element   (JsonNode *array, int index);
@@ -0,0 +1,75 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <poll.h>
+
+#include "../src/multi_pouch.h"
+
+/*
+ * Drives pouch requests from a plain poll() loop, as an application with an
+ * event loop of its own (GLib, a custom reactor, ...) would: it watches
+ * pmi_fd(), waits no longer than pmi_timeout() and calls pmi_process(),
+ * which hands the finished requests over in batches.
+ *
+ * usage: ./poll_embed [server] [number of documents]
+ */
+
+static int batches = 0;
+static int finished = 0;
+
+static void got_batch(PouchReq **reqs, size_t n, PouchMInfo *pmi){
+	size_t i;
+	batches++;
+	for (i = 0; i < n; i++){
+		if (reqs[i]->curlcode != CURLE_OK || reqs[i]->httpresponse != 200)
+			fprintf(stderr, "%s: %s (%ld)\n", reqs[i]->url,
+					curl_easy_strerror(reqs[i]->curlcode), reqs[i]->httpresponse);
+		finished++;
+		pr_free(reqs[i]);
+	}
+}
+
+int main(int argc, char* argv[]){
+	char *server = argc > 1 ? argv[1] : "http://127.0.0.1:5984";
+	int n = argc > 2 ? atoi(argv[2]) : 100;
+	char *db = "pouch_poll_embed";
+	char id[32];
+	int i;
+
+	PouchReq *pr = pr_init();
+	pr = db_create(pr, server, db);
+	pr_do(pr);
+	if (pr->curlcode != CURLE_OK){
+		fprintf(stderr, "could not reach %s: %s\n", server,
+				curl_easy_strerror(pr->curlcode));
+		pr_free(pr);
+		return 1;
+	}
+	for (i = 0; i < n; i++){
+		snprintf(id, sizeof(id), "doc-%d", i);
+		pr = doc_create_id(pr, server, db, id, "{\"type\":\"example\"}");
+		pr_do(pr);
+	}
+
+	PouchMInfo *pmi = pr_mk_pmi_epoll(NULL, NULL);
+	pmi_set_batch_cb(pmi, got_batch);
+	for (i = 0; i < n; i++){
+		snprintf(id, sizeof(id), "doc-%d", i);
+		pr_dopmi(doc_get(pr_init(), server, db, id), pmi);
+	}
+
+	// the application's own loop; pouch only needs one fd watched
+	struct pollfd pfd = { pmi_fd(pmi), POLLIN, 0 };
+	int running = 1;
+	while (running > 0){
+		poll(&pfd, 1, (int)pmi_timeout(pmi));
+		running = pmi_process(pmi);
+	}
+	printf("%d documents in %d batches\n", finished, batches);
+
+	pr_del_pmi(pmi);
+	pr = db_delete(pr, server, db);
+	pr_do(pr);
+	pr_free(pr);
+	return 0;
+}
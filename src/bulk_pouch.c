@@ -0,0 +1,570 @@
+// Standard libraries
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+#include <ctype.h>
+#include <unistd.h>
+
+#include "bulk_pouch.h"
+#include "rev_pouch.h"
+
+#define BATCH_HEAD "{\"docs\":["
+#define BATCH_TAIL "]}"
+
+/** PouchBatch
+ *
+ *  A batch sent with the multi interface, kept in its PouchReq's custom
+ *  pointer until the response arrives.
+ */
+typedef struct {
+    PouchBulk *pb;
+    void **customs;
+    size_t count;
+} PouchBatch;
+
+static void pb_destroy(PouchBulk *pb);
+
+static long ms_since(struct timespec *t){
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - t->tv_sec)*1000 + (now.tv_nsec - t->tv_nsec)/1000000;
+}
+
+// makes room for need more bytes in the batch body
+static int pb_reserve(PouchBulk *pb, size_t need){
+    if (pb->len + need <= pb->alloc){
+        return 0;
+    }
+    size_t alloc = pb->alloc ? pb->alloc : 4096;
+    while (alloc < pb->len + need){
+        alloc *= 2;
+    }
+    char *buf = (char *)realloc(pb->buf, alloc);
+    if (!buf){
+        return -1;
+    }
+    pb->buf = buf;
+    pb->alloc = alloc;
+    return 0;
+}
+
+// Results
+static void pb_deliver(PouchBulk *pb, void *custom, const char *id, const char *rev, const char *error, const char *reason){
+    if (error){
+        pb->failed++;
+    } else {
+        pb->written++;
+    }
+    if (pb->cb){
+        pb->cb(pb, custom, id, rev, error, reason);
+    }
+}
+
+// updates the revision cache with a document's result
+static void pb_remember(PouchBulk *pb, const char *id, const char *rev, const char *error){
+    if (!id || (!rev && !error) || !rev_cache_enabled()){
+        return;
+    }
+    char *url = NULL;
+    url = combine(&url, pb->server, pb->db, "/");
+    url = combine(&url, url, (char *)id, "/");
+    if (rev && !error){
+        rev_cache_put(url, rev);
+    } else if (!strcmp(error, "conflict")){	// the revision we had was stale
+        rev_cache_drop(url);
+    }
+    free(url);
+}
+
+// hands each document of a finished batch its result; returns 0 if the
+// request itself succeeded
+static int pb_results(PouchBulk *pb, PouchReq *pr, void **customs, size_t count){
+    const char *json = pr->resp.data ? pr->resp.data : "";
+    const char *end = json + pr->resp.size;
+    const char *el = NULL;
+    size_t i = 0, len;
+    if (pr->curlcode == CURLE_OK){	// one result per document, in order
+        while (i < count && (el = scan_element(json, end, el, &len))){
+            char *id = scan_member_dup(el, len, "id");
+            char *rev = scan_member_dup(el, len, "rev");
+            char *error = scan_member_dup(el, len, "error");
+            char *reason = scan_member_dup(el, len, "reason");
+            pb_remember(pb, id, rev, error);
+            pb_deliver(pb, customs[i++], id, rev, error, reason);
+            free(id);
+            free(rev);
+            free(error);
+            free(reason);
+        }
+    }
+    if (i == count){
+        return 0;
+    }
+    // the request failed as a whole (e.g. 401 or a lost connection)
+    char *error = scan_member_dup(json, end - json, "error");
+    char *reason = scan_member_dup(json, end - json, "reason");
+    const char *why = pr->curlcode != CURLE_OK ? curl_easy_strerror(pr->curlcode) : reason;
+    for (; i < count; i++){
+        pb_deliver(pb, customs[i], NULL, NULL, error ? error : "request_failed", why);
+    }
+    free(error);
+    free(reason);
+    return -1;
+}
+
+// Sending
+static PouchReq *pb_request(PouchBulk *pb, PouchReq *pr){
+    pr_set_method(pr, POST);
+    pr_set_url(pr, pb->server);
+    pr->url = combine(&(pr->url), pr->url, pb->db, "/");
+    pr->url = combine(&(pr->url), pr->url, "_bulk_docs", "/");
+    memcpy(pb->buf + pb->len, BATCH_TAIL, sizeof(BATCH_TAIL));	// reserved by pb_add
+    pr_set_prdata(pr, pb->buf, pb->len + strlen(BATCH_TAIL));	// the request takes the body
+    pb->buf = NULL;
+    pb->len = pb->alloc = 0;
+    return pr;
+}
+static void pb_batch_done(PouchReq *pr, PouchMInfo *pmi){
+    PouchBatch *batch = (PouchBatch *)pr->custom;
+    PouchBulk *pb = batch->pb;
+    pb->in_flight--;	// no longer counted while its results are handed out
+    pb_results(pb, pr, batch->customs, batch->count);
+    free(batch->customs);
+    free(batch);
+    pr_free(pr);
+    if (pb->freed && pb->in_flight == 0){
+        pb_destroy(pb);
+    }
+}
+static void pb_timer_cb(int fd, short kind, void *userp){
+    pb_flush((PouchBulk *)userp);
+}
+int pb_flush(PouchBulk *pb){
+    if (pb->count == 0){
+        return 0;
+    }
+    if (pb->pmi){
+        if (evtimer_pending(&pb->timer_event, NULL)){
+            evtimer_del(&pb->timer_event);
+        }
+        PouchBatch *batch = (PouchBatch *)malloc(sizeof(PouchBatch));
+        if (!batch){
+            return -1;
+        }
+        batch->pb = pb;
+        batch->customs = pb->customs;	// the batch takes the custom pointers
+        batch->count = pb->count;
+        pb->customs = NULL;
+        pb->count = pb->customs_alloc = 0;
+        PouchReq *pr = pb_request(pb, pr_init());
+        pr_set_done(pr, pb_batch_done, batch);
+        pb->in_flight++;
+        pr_dopmi(pr, pb->pmi);
+        return 0;
+    }
+    void **customs = pb->customs;	// the callback may start a new batch
+    size_t count = pb->count;
+    pb->customs = NULL;
+    pb->count = pb->customs_alloc = 0;
+    pr_do(pb_request(pb, pb->pr));
+    int ret = pb_results(pb, pb->pr, customs, count);
+    free(customs);
+    return ret;
+}
+
+// PouchBulk functions
+PouchBulk *pb_init(char *server, char *db, PouchMInfo *pmi, pb_result_cb cb, void *custom){
+    if (pmi && pmi->backend != POUCH_BACKEND_LIBEVENT){	// the latency timer is a libevent event
+        fprintf(stderr, "ERROR: PouchBulk needs a libevent PouchMInfo\n");
+        return NULL;
+    }
+    PouchBulk *pb = (PouchBulk *)calloc(1, sizeof(PouchBulk));
+    if (!pb){
+        return NULL;
+    }
+    pb->server = strdup(server);
+    pb->db = strdup(db);
+    pb->pmi = pmi;
+    pb->cb = cb;
+    pb->custom = custom;
+    pb->max_docs = POUCH_BULK_DOCS;
+    pb->max_bytes = POUCH_BULK_BYTES;
+    pb->max_latency_ms = POUCH_BULK_LATENCY_MS;
+    if (pmi){
+        evtimer_set(&pb->timer_event, pb_timer_cb, (void *)pb);
+        event_base_set(pmi->base, &pb->timer_event);
+    } else {
+        pb->pr = pr_init();
+    }
+    return pb;
+}
+PouchBulk *pb_set_thresholds(PouchBulk *pb, size_t max_docs, size_t max_bytes, long max_latency_ms){
+    if (max_docs){
+        pb->max_docs = max_docs;
+    }
+    if (max_bytes){
+        pb->max_bytes = max_bytes;
+    }
+    if (max_latency_ms){
+        pb->max_latency_ms = max_latency_ms < 0 ? 0 : max_latency_ms;
+    }
+    return pb;
+}
+int pb_add(PouchBulk *pb, const char *json, void *custom){
+    size_t length = strlen(json);
+    if (pb->count == pb->customs_alloc){
+        size_t n = pb->customs_alloc ? 2*pb->customs_alloc : 64;
+        void **customs = (void **)realloc(pb->customs, n*sizeof(void *));
+        if (!customs){
+            return -1;
+        }
+        pb->customs = customs;
+        pb->customs_alloc = n;
+    }
+    // room for the document, a separator and the closing BATCH_TAIL
+    if (pb_reserve(pb, sizeof(BATCH_HEAD) + length + sizeof(BATCH_TAIL)) != 0){
+        return -1;
+    }
+    if (pb->count == 0){	// first document of a new batch
+        pb->len = strlen(BATCH_HEAD);
+        memcpy(pb->buf, BATCH_HEAD, pb->len);
+        clock_gettime(CLOCK_MONOTONIC, &pb->first);
+        if (pb->pmi && pb->max_latency_ms > 0){
+            struct timeval timeout;
+            timeout.tv_sec = pb->max_latency_ms/1000;
+            timeout.tv_usec = (pb->max_latency_ms%1000)*1000;
+            evtimer_add(&pb->timer_event, &timeout);
+        }
+    } else {
+        pb->buf[pb->len++] = ',';
+    }
+    memcpy(pb->buf + pb->len, json, length);
+    pb->len += length;
+    pb->customs[pb->count++] = custom;
+
+    if (pb->count >= pb->max_docs || pb->len >= pb->max_bytes ||
+            (!pb->pmi && pb->max_latency_ms > 0 && ms_since(&pb->first) >= pb->max_latency_ms)){
+        pb_flush(pb);
+    }
+    return 0;
+}
+static void pb_destroy(PouchBulk *pb){
+    if (pb->pr){
+        pr_free(pb->pr);
+    }
+    free(pb->server);
+    free(pb->db);
+    free(pb->buf);
+    free(pb->customs);
+    free(pb);
+}
+void pb_free(PouchBulk *pb){
+    if (!pb){
+        return;
+    }
+    pb_flush(pb);
+    if (pb->pmi){
+        if (evtimer_pending(&pb->timer_event, NULL)){
+            evtimer_del(&pb->timer_event);
+        }
+        if (pb->in_flight > 0){	// the last batch to finish frees it
+            pb->freed = 1;
+            return;
+        }
+    }
+    pb_destroy(pb);
+}
+
+// Deleting many documents
+
+/** PouchWipe
+ *
+ *  State of a pb_delete_all(): the streaming _all_docs request and the
+ *  PouchBulk its tombstones go to.
+ */
+typedef struct {
+    PouchBulk *pb;
+    PouchReq *list;		// GET _all_docs, streamed through ss
+    ScanStream ss;		// splits the listing into rows
+    int keep_design;	// skip ids starting with _design/
+    int max_in_flight;	// pause the listing while this many batches are out
+    pb_result_cb cb;	// USER DEFINED callback for each document's result
+    void *custom;		// USER DEFINED pointer passed to cb with each document
+} PouchWipe;
+
+static int wipe_row(ScanStream *ss, const char *key, int depth, const char *val, size_t len, void *userp){
+    PouchWipe *w = (PouchWipe *)userp;
+    const char *end = val + len;
+    size_t id_len, value_len, rev_len;
+    char tombstone[512];
+    if (depth != 2 || *val != '{'){
+        return 0;	// total_rows and offset
+    }
+    // the id and rev are copied as JSON text, so nothing needs escaping
+    const char *id = scan_member(val, end, "id", &id_len);
+    const char *value = scan_member(val, end, "value", &value_len);
+    const char *rev = value ? scan_member(value, value + value_len, "rev", &rev_len) : NULL;
+    if (!id || !rev){
+        return 0;
+    }
+    if (w->keep_design && !strncmp(id, "\"_design/", 9)){
+        return 0;
+    }
+    size_t need = id_len + rev_len + sizeof("{\"_id\":,\"_rev\":,\"_deleted\":true}");
+    char *doc = need <= sizeof(tombstone) ? tombstone : (char *)malloc(need);
+    if (!doc){
+        return 1;
+    }
+    snprintf(doc, need, "{\"_id\":%.*s,\"_rev\":%.*s,\"_deleted\":true}",
+            (int)id_len, id, (int)rev_len, rev);
+    pb_add(w->pb, doc, w->custom);
+    if (doc != tombstone){
+        free(doc);
+    }
+    return 0;
+}
+static size_t wipe_sink(PouchReq *pr, char *data, size_t len, void *userp){
+    PouchWipe *w = (PouchWipe *)userp;
+    if (w->pb->in_flight >= w->max_in_flight){
+        return POUCH_SINK_PAUSE;	// wait for the batches to catch up
+    }
+    return scan_feed(&w->ss, data, len) == 0 ? len : 0;
+}
+static void wipe_result(PouchBulk *pb, void *custom, const char *id, const char *rev, const char *error, const char *reason){
+    PouchWipe *w = (PouchWipe *)pb->custom;
+    if (w->cb){
+        w->cb(pb, custom, id, rev, error, reason);
+    }
+    if (w->list->paused && pb->in_flight < w->max_in_flight){
+        pr_resume(w->list);
+    }
+}
+static void wipe_listed(PouchReq *pr, PouchMInfo *pmi){
+    PouchWipe *w = (PouchWipe *)pr->custom;
+    pb_flush(w->pb);	// the last, partial batch
+}
+long pb_delete_all(char *server, char *db, int keep_design, int max_in_flight, pb_result_cb cb, void *custom){
+    PouchWipe w;
+    long deleted = -1;
+    struct event_base *base = event_base_new();
+    PouchMInfo *pmi = pr_mk_pmi(base, NULL, NULL, NULL);
+    if (!pmi){
+        return -1;
+    }
+    memset(&w, 0, sizeof(w));
+    w.keep_design = keep_design;
+    w.max_in_flight = max_in_flight > 0 ? max_in_flight : POUCH_DELETE_IN_FLIGHT;
+    w.cb = cb;
+    w.custom = custom;
+    w.pb = pb_init(server, db, pmi, wipe_result, &w);
+    w.list = get_all_docs(pr_init(), server, db);
+    scan_init(&w.ss, 2, wipe_row, &w);
+    pr_set_sink(w.list, wipe_sink, &w);
+    pr_set_done(w.list, wipe_listed, &w);
+    pr_dopmi(w.list, pmi);
+    event_base_dispatch(base);	// returns once the listing and every batch are done
+
+    if (w.list->curlcode == CURLE_OK && w.list->httpresponse == 200){
+        deleted = w.pb->written;
+    }
+    pb_free(w.pb);
+    pr_free(w.list);
+    scan_reset(&w.ss);
+    pr_del_pmi(pmi);
+    return deleted;
+}
+
+// copies the JSON object json without its member key (which must not need
+// escaping), walking the members with scan_skip() so that nothing inside a
+// value is mistaken for a key. Returns a new string, or NULL if json is not
+// an object.
+static char *copy_without_member(const char *json, size_t len, const char *key, size_t *out_len){
+    const char *end = json + len;
+    const char *p = json;
+    size_t key_len = strlen(key);
+    char *out = (char *)malloc(len + 1);
+    size_t o = 0;
+    if (!out){
+        return NULL;
+    }
+    while (p < end && isspace((unsigned char)*p)){
+        p++;
+    }
+    if (p >= end || *p != '{'){
+        free(out);
+        return NULL;
+    }
+    out[o++] = '{';
+    p++;
+    while (p < end){
+        while (p < end && (isspace((unsigned char)*p) || *p == ',')){
+            p++;
+        }
+        if (p < end && *p == '}'){
+            break;
+        }
+        const char *name = p;
+        const char *name_end = scan_skip(name, end);	// the quoted key
+        const char *val = name_end;
+        while (val && val < end && (isspace((unsigned char)*val) || *val == ':')){
+            val++;
+        }
+        const char *val_end = val ? scan_skip(val, end) : NULL;
+        if (*name != '"' || !val_end){
+            free(out);
+            return NULL;
+        }
+        if ((size_t)(name_end - name - 2) != key_len || strncmp(name + 1, key, key_len)){
+            if (o > 1){
+                out[o++] = ',';
+            }
+            memcpy(out + o, name, name_end - name);
+            o += name_end - name;
+            out[o++] = ':';
+            memcpy(out + o, val, val_end - val);
+            o += val_end - val;
+        }
+        p = val_end;
+    }
+    out[o++] = '}';
+    out[o] = '\0';
+    *out_len = o;
+    return out;
+}
+
+static int is_2xx(PouchReq *pr){
+    return pr->curlcode == CURLE_OK && pr->httpresponse >= 200 && pr->httpresponse < 300;
+}
+
+// counts the design documents that could not be put back; a conflict means
+// an earlier attempt already did
+static void restore_result(PouchBulk *pb, void *custom, const char *id, const char *rev, const char *error, const char *reason){
+    if (error && strcmp(error, "conflict")){
+        (*(size_t *)pb->custom)++;
+    }
+}
+
+// puts the saved _security object and design documents into the new
+// database. Returns the number of design documents in it, or -1.
+static long restore_saved(char *server, char *db, const char *security, size_t security_len, char **designs, size_t n){
+    size_t i, failed = 0;
+    if (security_len > 2){	// not just "{}"
+        PouchReq *pr = pr_init();
+        pr_set_method(pr, PUT);
+        pr_set_url(pr, server);
+        pr->url = combine(&(pr->url), pr->url, db, "/");
+        pr->url = combine(&(pr->url), pr->url, "_security", "/");
+        pr_set_bdata(pr, (void *)security, security_len);
+        pr_do(pr);
+        int ok = is_2xx(pr);
+        pr_free(pr);
+        if (!ok){
+            return -1;
+        }
+    }
+    if (n > 0){
+        PouchBulk *pb = pb_init(server, db, NULL, restore_result, &failed);
+        for (i = 0; i < n; i++){
+            pb_add(pb, designs[i], NULL);
+        }
+        pb_flush(pb);
+        pb_free(pb);
+    }
+    return failed ? -1 : (long)n;
+}
+
+// writes what could not be put back to stderr, so that it is not lost
+static void report_saved(char *db, const char *security, size_t security_len, char **designs, size_t n){
+    size_t i;
+    fprintf(stderr, "pb_truncate: could not restore %s; its _security object and design documents were:\n", db);
+    fprintf(stderr, "{\"_security\":%.*s,\"docs\":[", (int)security_len, security ? security : "{}");
+    for (i = 0; i < n; i++){
+        fprintf(stderr, "%s%s", i ? "," : "", designs[i]);
+    }
+    fprintf(stderr, "]}\n");
+}
+
+long pb_truncate(char *server, char *db){
+    long restored = -1;
+    size_t n = 0, i, len, security_len = 0;
+    char **designs = NULL;
+    char *security = NULL;
+    int attempt;
+    PouchReq *pr = pr_init();
+
+    // save the _security object
+    pr_set_method(pr, GET);
+    pr_set_url(pr, server);
+    pr->url = combine(&(pr->url), pr->url, db, "/");
+    pr->url = combine(&(pr->url), pr->url, "_security", "/");
+    pr_do(pr);
+    if (pr->curlcode != CURLE_OK || pr->httpresponse != 200){
+        goto done;
+    }
+    security = pr_take_resp(pr, &security_len);
+
+    // save the design documents, with their attachments inline
+    pr = get_all_docs(pr, server, db);
+    pr_add_param(pr, "startkey", "%22_design%2F%22");
+    pr_add_param(pr, "endkey", "%22_design0%22");	// '0' follows '/'
+    pr_add_param(pr, "include_docs", "true");
+    pr_add_param(pr, "attachments", "true");
+    pr_do(pr);
+    if (pr->curlcode != CURLE_OK || pr->httpresponse != 200){
+        goto done;
+    }
+    const char *json = pr->resp.data;
+    const char *end = json + pr->resp.size;
+    const char *rows = scan_member(json, end, "rows", &len);
+    const char *row = NULL;
+    size_t row_len;
+    while (rows && (row = scan_element(rows, rows + len, row, &row_len))){
+        size_t doc_len;
+        const char *doc = scan_member(row, row + row_len, "doc", &doc_len);
+        if (!doc || *doc != '{'){
+            continue;
+        }
+        char **d = (char **)realloc(designs, (n + 1)*sizeof(char *));
+        if (!d){
+            goto done;
+        }
+        designs = d;
+        // the new database has no revisions yet
+        designs[n] = copy_without_member(doc, doc_len, "_rev", &doc_len);
+        if (!designs[n]){
+            goto done;
+        }
+        n++;
+    }
+
+    // recreate the database; clusters answer 202 Accepted
+    pr = db_delete(pr, server, db);
+    pr_do(pr);
+    if (!is_2xx(pr)){
+        goto done;	// nothing lost yet
+    }
+    // from here on the saved copies are all there is, so keep at it
+    for (attempt = 0; attempt < POUCH_TRUNCATE_TRIES && restored < 0; attempt++){
+        if (attempt){
+            sleep(1);
+        }
+        pr = db_create(pr, server, db);
+        pr_do(pr);
+        if (is_2xx(pr) || (pr->curlcode == CURLE_OK && pr->httpresponse == 412)){	// or made by an earlier try
+            restored = restore_saved(server, db, security, security_len, designs, n);
+        }
+    }
+    if (restored < 0){
+        report_saved(db, security, security_len, designs, n);
+    }
+
+done:
+    for (i = 0; i < n; i++){
+        free(designs[i]);
+    }
+    free(designs);
+    free(security);
+    pr_free(pr);
+    return restored;
+}
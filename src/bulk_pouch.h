@@ -0,0 +1,132 @@
+#ifndef __BULK_POUCH_H__
+#define __BULK_POUCH_H__
+
+// Standard libraries
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+
+// Pouch helpers
+#include "multi_pouch.h"
+#include "scan_pouch.h"
+
+// Defines
+#define POUCH_BULK_DOCS 1000			// default most documents per _bulk_docs POST
+#define POUCH_BULK_BYTES (4*1024*1024)	// default most bytes per _bulk_docs POST
+#define POUCH_BULK_LATENCY_MS 500		// default longest a document waits to be sent
+#define POUCH_DELETE_IN_FLIGHT 4		// default batches in flight while deleting
+#define POUCH_TRUNCATE_TRIES 5			// attempts pb_truncate makes to restore a database
+
+// Structs
+typedef struct _PouchBulk PouchBulk;
+
+/** pb_result_cb
+ *
+ *  Called once for every document written by a PouchBulk, with the custom
+ *  pointer that was passed to pb_add() along with it. On success rev is the
+ *  document's new revision and error is NULL; otherwise error and reason
+ *  describe what went wrong (e.g. "conflict"). id is NULL if the whole
+ *  request failed before the server could answer for the document.
+ */
+typedef void (*pb_result_cb)(PouchBulk *pb, void *custom, const char *id, const char *rev, const char *error, const char *reason);
+
+/** _PouchBulk
+ *
+ *  Collects documents added one at a time and writes them to a database
+ *  with _bulk_docs POSTs, so the number of round trips depends on the
+ *  number of batches rather than the number of documents. A batch is sent
+ *  as soon as it holds max_docs documents or max_bytes bytes, or when its
+ *  oldest document has waited max_latency_ms.
+ *
+ *  Without a PouchMInfo, batches are sent with pr_do() from pb_add() or
+ *  pb_flush(), and the latency is only checked when a document is added. With
+ *  one, batches are sent on its event loop, several may be in flight at once,
+ *  and a libevent timer enforces the latency. The PouchMInfo must use the
+ *  libevent backend, since the epoll backend has no timers to offer.
+ */
+struct _PouchBulk {
+    char *server;
+    char *db;
+    PouchMInfo *pmi;		// event loop to send batches on, or NULL for pr_do()
+    PouchReq *pr;			// request reused for every pr_do() batch
+    pb_result_cb cb;		// USER DEFINED callback for each document's result
+    void *custom;			// USER DEFINED pointer to some data
+    size_t max_docs;		// send a batch once it has this many documents,
+    size_t max_bytes;		// ... or this many bytes,
+    long max_latency_ms;	// ... or its first document is this old (0: never)
+    char *buf;				// JSON body of the batch being collected
+    size_t len;				// ... bytes in buf
+    size_t alloc;			// ... bytes allocated for buf
+    void **customs;			// custom pointer of each document in the batch
+    size_t count;			// ... number of documents in the batch
+    size_t customs_alloc;	// ... number of pointers allocated
+    struct timespec first;	// when the batch's first document was added
+    struct event timer_event;	// flushes a batch that waited too long
+    int in_flight;			// batches sent with the PouchMInfo, not yet done
+    int freed;				// pb_free() was called while batches were in flight
+    long written;			// documents written successfully
+    long failed;			// documents the server or the request rejected
+};
+
+/** Create a bulk writer for db. pmi may be NULL to send batches with
+ *  pr_do(). cb may be NULL if the results are not needed. Returns NULL if
+ *  pmi uses the epoll backend.
+ */
+PouchBulk *pb_init(char *server, char *db, PouchMInfo *pmi, pb_result_cb cb, void *custom);
+
+/** Set the thresholds at which a batch is sent. 0 keeps the current value,
+ *  except that a max_latency_ms of -1 turns the latency limit off.
+ */
+PouchBulk *pb_set_thresholds(PouchBulk *pb, size_t max_docs, size_t max_bytes, long max_latency_ms);
+
+/** Add a document (a JSON object, copied) to the current batch, sending the
+ *  batch if that crosses a threshold. custom is handed back to the
+ *  pb_result_cb with the document's result. Returns 0, or -1 if the document
+ *  could not be added.
+ */
+int pb_add(PouchBulk *pb, const char *json, void *custom);
+
+/** Send the current batch now, if it has any documents. Without a PouchMInfo
+ *  this returns once all of the batch's results have been delivered. Returns
+ *  0, or -1 if the request failed.
+ */
+int pb_flush(PouchBulk *pb);
+
+/** Flush the current batch and free the writer. With a PouchMInfo, batches
+ *  still in flight deliver their results as usual, and the writer is only
+ *  freed once the last of them is done. Don't call it from the
+ *  pb_result_cb.
+ */
+void pb_free(PouchBulk *pb);
+
+// Deleting many documents
+
+/** Delete every document of db with _bulk_docs tombstones.
+ *
+ *  The ids and revisions are streamed out of _all_docs, and tombstones are
+ *  written in batches while the listing is still arriving, with up to
+ *  max_in_flight batches (0 for POUCH_DELETE_IN_FLIGHT) in flight at once;
+ *  the listing is paused while that many are waiting. Design documents are
+ *  kept if keep_design is set. cb, if not NULL, gets every document's result
+ *  with custom. Runs its own event loop and returns once everything is done,
+ *  with the number of documents deleted, or -1 if the documents could not be
+ *  listed.
+ */
+long pb_delete_all(char *server, char *db, int keep_design, int max_in_flight, pb_result_cb cb, void *custom);
+
+/** Empty db by deleting and recreating it, which is much faster than
+ *  deleting its documents one by one and leaves no tombstones behind.
+ *
+ *  The _security object and the design documents (with their attachments)
+ *  are read first and put back in the new database; the design documents
+ *  start over at a new first revision. Any 2xx answer counts as success, as
+ *  clusters answer 202 Accepted. Once the database is deleted, recreating it
+ *  and restoring the saved copies is tried POUCH_TRUNCATE_TRIES times, a
+ *  second apart; if that never works out, the saved copies are written to
+ *  stderr as JSON so that they are not lost. Returns the number of design
+ *  documents restored, or -1 if anything failed.
+ */
+long pb_truncate(char *server, char *db);
+
+#endif
@@ -0,0 +1,239 @@
+// Standard libraries
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <sys/stat.h>
+
+#include "changes_pouch.h"
+
+static void pc_submit(PouchChanges *pc);
+
+// replaces *str with a copy of len bytes of val
+static void set_str(char **str, const char *val, size_t len){
+    free(*str);
+    *str = (char *)malloc(len + 1);
+    memcpy(*str, val, len);
+    (*str)[len] = '\0';
+}
+
+static long ms_since(struct timespec *t){
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - t->tv_sec)*1000 + (now.tv_nsec - t->tv_nsec)/1000000;
+}
+
+// Checkpoints
+static void pc_save(PouchChanges *pc){
+    if (!pc->checkpoint || !pc->since || !pc->dirty){
+        return;
+    }
+    char *tmp = NULL;
+    tmp = combine(&tmp, pc->checkpoint, ".tmp", NULL);
+    FILE *f = fopen(tmp, "w");
+    if (!f){
+        fprintf(stderr, "ERROR: could not write checkpoint %s\n", tmp);
+        free(tmp);
+        return;
+    }
+    fputs(pc->since, f);
+    if (fclose(f) == 0 && rename(tmp, pc->checkpoint) == 0){ // readers never see half a seq
+        pc->dirty = 0;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &pc->saved);
+    free(tmp);
+}
+static void pc_load(PouchChanges *pc){
+    struct stat st;
+    FILE *f = fopen(pc->checkpoint, "r");
+    if (!f){
+        return;	// nothing saved yet
+    }
+    if (fstat(fileno(f), &st) != 0){
+        fprintf(stderr, "ERROR: could not read checkpoint %s\n", pc->checkpoint);
+        fclose(f);
+        return;
+    }
+    char *buf = (char *)malloc(st.st_size + 1);
+    size_t len = buf ? fread(buf, 1, st.st_size, f) : 0;
+    fclose(f);
+    if (!buf || len != (size_t)st.st_size){
+        fprintf(stderr, "ERROR: could not read checkpoint %s\n", pc->checkpoint);
+        free(buf);
+        return;
+    }
+    while (len > 0 && isspace((unsigned char)buf[len - 1])){
+        len--;
+    }
+    if (len > 0){
+        set_str(&pc->since, buf, len);
+    }
+    free(buf);
+}
+
+// Parsing
+static void pc_row(PouchChanges *pc, const char *row, size_t len){
+    size_t seq_len;
+    const char *seq = scan_member(row, row + len, "seq", &seq_len);
+    char *id = scan_member_dup(row, len, "id");
+    if (seq && id){
+        char *s = scan_strdup(seq, seq_len);
+        free(pc->since);
+        pc->since = s;
+        pc->dirty = 1;
+        pc->rows++;
+        pc->cb(pc, s, id, row, len);
+    } else {	// the last line of a continuous feed only has "last_seq"
+        char *last = scan_member_dup(row, len, "last_seq");
+        if (last){
+            free(pc->since);
+            pc->since = last;
+            pc->dirty = 1;
+        }
+    }
+    free(id);
+}
+static int pc_value(ScanStream *ss, const char *key, int depth, const char *val, size_t len, void *userp){
+    PouchChanges *pc = (PouchChanges *)userp;
+    if (depth == ss->emit_depth && *val == '{'){	// a change row
+        pc_row(pc, val, len);
+    } else if (depth == 1 && key && !strcmp(key, "last_seq")){	// end of a longpoll batch
+        free(pc->since);
+        pc->since = scan_strdup(val, len);
+        pc->dirty = 1;
+    }
+    return !pc->running;	// the callback may have stopped the feed
+}
+static size_t pc_sink(PouchReq *pr, char *data, size_t len, void *userp){
+    PouchChanges *pc = (PouchChanges *)userp;
+    pc->in_sink = 1;
+    int failed = scan_feed(&pc->ss, data, len);
+    pc->in_sink = 0;
+    if (ms_since(&pc->saved) >= POUCH_CHANGES_SAVE_MS){	// a continuous feed may never end
+        pc_save(pc);
+    }
+    return failed ? 0 : len;	// 0 aborts the request
+}
+
+// Requests
+static void pc_retry_cb(int fd, short kind, void *userp){
+    pc_submit((PouchChanges *)userp);
+}
+static void pc_done(PouchReq *pr, PouchMInfo *pmi){
+    PouchChanges *pc = (PouchChanges *)pr->custom;
+    pc_save(pc);
+    if (!pc->running){
+        return;
+    }
+    if (pr->curlcode == CURLE_OK && pr->httpresponse == 200 && pc->rows > 0){
+        pc_submit(pc);	// the batch is done, ask for the next one right away
+    } else {
+        struct timeval delay;
+        if (pr->curlcode != CURLE_OK || pr->httpresponse != 200){
+            fprintf(stderr, "ERROR: _changes of %s failed (%ld, %s), retrying\n",
+                    pc->db, pr->httpresponse, curl_easy_strerror(pr->curlcode));
+        }
+        // don't hammer a server that ends feeds early or is failing
+        delay.tv_sec = POUCH_CHANGES_RETRY_MS/1000;
+        delay.tv_usec = (POUCH_CHANGES_RETRY_MS%1000)*1000;
+        evtimer_add(&pc->retry_event, &delay);
+    }
+}
+static void pc_submit(PouchChanges *pc){
+    char num[32];
+    PouchReq *pr = pc->pr;
+    scan_reset(&pc->ss);	// drop anything left of an aborted response
+    pc->rows = 0;
+
+    pr = db_get_changes(pr, pc->server, pc->db);
+    pr_add_param(pr, "feed", pc->feed == POUCH_FEED_CONTINUOUS ? "continuous" : "longpoll");
+    if (pc->since){
+        char *since = curl_easy_escape(NULL, pc->since, 0);
+        pr_add_param(pr, "since", since);
+        curl_free(since);
+    }
+    if (pc->heartbeat > 0){
+        snprintf(num, sizeof(num), "%ld", pc->heartbeat);
+        pr_add_param(pr, "heartbeat", num);
+    }
+    if (pc->limit > 0){
+        snprintf(num, sizeof(num), "%ld", pc->limit);
+        pr_add_param(pr, "limit", num);
+    }
+    if (pc->include_docs){
+        pr_add_param(pr, "include_docs", "true");
+    }
+    pr_set_sink(pr, pc_sink, pc);
+    pr_set_done(pr, pc_done, pc);
+    pr_dopmi(pr, pc->pmi);
+}
+
+// PouchChanges functions
+PouchChanges *pc_init(PouchMInfo *pmi, char *server, char *db, int feed, pc_change_cb cb, void *custom){
+    if (pmi->backend != POUCH_BACKEND_LIBEVENT){	// the retry timer is a libevent event
+        fprintf(stderr, "ERROR: PouchChanges needs a libevent PouchMInfo\n");
+        return NULL;
+    }
+    PouchChanges *pc = (PouchChanges *)calloc(1, sizeof(PouchChanges));
+    if (!pc){
+        return NULL;
+    }
+    pc->pmi = pmi;
+    pc->pr = pr_init();
+    set_str(&pc->server, server, strlen(server));
+    set_str(&pc->db, db, strlen(db));
+    pc->feed = feed;
+    pc->cb = cb;
+    pc->custom = custom;
+    // rows are array elements in a longpoll response and whole lines in a
+    // continuous one
+    scan_init(&pc->ss, feed == POUCH_FEED_CONTINUOUS ? 0 : 2, pc_value, pc);
+    evtimer_set(&pc->retry_event, pc_retry_cb, (void *)pc);
+    event_base_set(pmi->base, &pc->retry_event);
+    return pc;
+}
+PouchChanges *pc_set_since(PouchChanges *pc, char *seq){
+    set_str(&pc->since, seq, strlen(seq));
+    pc->dirty = 1;
+    return pc;
+}
+PouchChanges *pc_set_checkpoint(PouchChanges *pc, char *path){
+    set_str(&pc->checkpoint, path, strlen(path));
+    pc_load(pc);
+    return pc;
+}
+PouchChanges *pc_set_options(PouchChanges *pc, long heartbeat, long limit, int include_docs){
+    pc->heartbeat = heartbeat;
+    pc->limit = limit;
+    pc->include_docs = include_docs;
+    return pc;
+}
+void pc_start(PouchChanges *pc){
+    if (pc->running){
+        return;
+    }
+    pc->running = 1;
+    pc_submit(pc);
+}
+void pc_stop(PouchChanges *pc){
+    pc->running = 0;
+    if (evtimer_pending(&pc->retry_event, NULL)){
+        evtimer_del(&pc->retry_event);
+    }
+    if (!pc->in_sink){	// otherwise the sink aborts the request itself
+        pr_cancel(pc->pr, pc->pmi);
+    }
+    pc_save(pc);
+}
+void pc_free(PouchChanges *pc){
+    if (!pc){
+        return;
+    }
+    pc_stop(pc);
+    pr_free(pc->pr);
+    scan_reset(&pc->ss);
+    free(pc->server);
+    free(pc->db);
+    free(pc->since);
+    free(pc->checkpoint);
+    free(pc);
+}
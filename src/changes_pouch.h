@@ -0,0 +1,103 @@
+#ifndef __CHANGES_POUCH_H__
+#define __CHANGES_POUCH_H__
+
+// Standard libraries
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+
+// Pouch helpers
+#include "multi_pouch.h"
+#include "scan_pouch.h"
+
+// Defines
+#define POUCH_FEED_LONGPOLL 0	// one request per batch of changes
+#define POUCH_FEED_CONTINUOUS 1	// one long-lived request, a change per line
+#define POUCH_CHANGES_RETRY_MS 1000	// wait this long before retrying a failed request
+#define POUCH_CHANGES_SAVE_MS 1000	// most time between checkpoint writes during a request
+
+// Structs
+typedef struct _PouchChanges PouchChanges;
+
+/** pc_change_cb
+ *
+ *  Called for every change received. seq and id are the change's "seq" and
+ *  "id" (seq is JSON text if the server sends numbers), json/len the whole
+ *  change row, including "doc" if include_docs is set. None of them are valid
+ *  after the callback returns.
+ */
+typedef void (*pc_change_cb)(PouchChanges *pc, const char *seq, const char *id, const char *json, size_t len);
+
+/** _PouchChanges
+ *
+ *  Follows the _changes feed of a database on a PouchMInfo's event loop.
+ *  Rows are parsed as they arrive, and after every request the feed is
+ *  restarted from the last seq received, so the follower never rescans
+ *  changes it has already seen. If a checkpoint file is set, the last seq is
+ *  saved to it as well, so a restarted program resumes where it left off.
+ *  The checkpoint is written when a request ends, and at most every
+ *  POUCH_CHANGES_SAVE_MS while one is still streaming.
+ *
+ *  Used in the multi interface only, with a PouchMInfo on the libevent
+ *  backend: retries wait on a libevent timer, which the epoll backend has
+ *  no loop to run.
+ */
+struct _PouchChanges {
+    PouchMInfo *pmi;		// event loop the feed runs on
+    PouchReq *pr;			// request for the feed, reused for every batch
+    char *server;
+    char *db;
+    int feed;				// POUCH_FEED_LONGPOLL or POUCH_FEED_CONTINUOUS
+    char *since;			// seq to continue from, or NULL for the start
+    long heartbeat;			// ms between heartbeats sent by the server (0 for none)
+    long limit;				// most changes per request (0 for no limit)
+    int include_docs;		// send each change's document along
+    char *checkpoint;		// file the last seq is saved in, or NULL
+    int dirty;				// since changed and has not been saved yet
+    struct timespec saved;	// when the checkpoint was last written
+    pc_change_cb cb;		// USER DEFINED callback for every change
+    void *custom;			// USER DEFINED pointer to some data
+    ScanStream ss;			// splits the response into change rows
+    struct event retry_event;	// restarts the feed after an error
+    int running;			// pc_start() was called and pc_stop() wasn't
+    int in_sink;			// the response is being parsed right now
+    long rows;				// changes received by the current request
+};
+
+/** Create a follower for the _changes feed of db. Nothing is requested until
+ *  pc_start() is called. Returns NULL if pmi uses the epoll backend.
+ */
+PouchChanges *pc_init(PouchMInfo *pmi, char *server, char *db, int feed, pc_change_cb cb, void *custom);
+
+/** Start from seq instead of from the beginning of the feed ("now" skips
+ *  all existing changes)
+ */
+PouchChanges *pc_set_since(PouchChanges *pc, char *seq);
+
+/** Save the last seq received to path, and start from the seq saved there if
+ *  the file already exists. The file is replaced atomically when a request
+ *  ends, and at most every POUCH_CHANGES_SAVE_MS while one is streaming.
+ */
+PouchChanges *pc_set_checkpoint(PouchChanges *pc, char *path);
+
+/** Set the heartbeat interval in ms, the most changes per request and
+ *  whether to include documents. 0 leaves out heartbeat and limit.
+ */
+PouchChanges *pc_set_options(PouchChanges *pc, long heartbeat, long limit, int include_docs);
+
+/** Start following the feed. Failed requests, and requests the server ended
+ *  without sending any changes, are retried after POUCH_CHANGES_RETRY_MS.
+ */
+void pc_start(PouchChanges *pc);
+
+/** Stop following the feed, cancelling the request in flight and saving the
+ *  checkpoint. pc_start() picks up where it stopped. May be called from the
+ *  pc_change_cb.
+ */
+void pc_stop(PouchChanges *pc);
+
+/** Stop the feed and free the follower */
+void pc_free(PouchChanges *pc);
+
+#endif
@@ -0,0 +1,188 @@
+// Standard libraries
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "download_pouch.h"
+
+/** PouchSegment
+ *
+ *  One byte range of a download, or the whole of it if end is -1
+ */
+typedef struct {
+    int *failed;		// shared by all segments of a download
+    int fd;				// file to write to
+    curl_off_t pos;		// offset the next byte goes to
+    curl_off_t end;		// offset just past the range, or -1
+    int checked;		// the response status was checked
+} PouchSegment;
+
+// writes a segment's data where it belongs in the file
+static size_t segment_sink(PouchReq *pr, char *data, size_t len, void *userp){
+    PouchSegment *seg = (PouchSegment *)userp;
+    size_t left = len;
+    if (*seg->failed){	// another segment failed, stop this one as well
+        return 0;
+    }
+    if (!seg->checked){	// error bodies, or a whole attachment sent back for
+                        // a range, must not be written
+        long code = 0;
+        curl_easy_getinfo(pr->easy, CURLINFO_RESPONSE_CODE, &code);
+        if (code != (seg->end < 0 ? 200 : 206)){
+            *seg->failed = 1;
+            return 0;
+        }
+        seg->checked = 1;
+    }
+    if (seg->end >= 0 && seg->pos + (curl_off_t)len > seg->end){
+        *seg->failed = 1;	// more than was asked for
+        return 0;
+    }
+    while (left > 0){
+        ssize_t n = pwrite(seg->fd, data, left, (off_t)seg->pos);
+        if (n < 0 && errno == EINTR){
+            continue;
+        }
+        if (n <= 0){
+            fprintf(stderr, "doc_download_attachment: write failed: %s\n",
+                    strerror(errno));
+            *seg->failed = 1;
+            return 0;
+        }
+        data += n;
+        left -= n;
+        seg->pos += n;
+    }
+    return len;
+}
+static void segment_done(PouchReq *pr, PouchMInfo *pmi){
+    PouchSegment *seg = (PouchSegment *)pr->custom;
+    if (pr->curlcode != CURLE_OK || !seg->checked ||
+            (seg->end >= 0 && seg->pos != seg->end)){
+        *seg->failed = 1;
+    }
+    // pr is kept for fetch_segments() to free
+}
+
+// fetches the attachment of size bytes as n ranges at once; returns 0 if
+// all of them arrived
+static int fetch_segments(char *server, char *db, char *id, char *name, int fd, int n, curl_off_t size, char *etag){
+    int failed = 0, i;
+    char range[64];
+    struct event_base *base = event_base_new();
+    PouchMInfo *pmi = pr_mk_pmi(base, NULL, NULL, NULL);
+    PouchSegment *segs = (PouchSegment *)calloc(n, sizeof(PouchSegment));
+    PouchReq **prs = (PouchReq **)calloc(n, sizeof(PouchReq *));
+    if (!pmi || !segs || !prs){
+        free(segs);
+        free(prs);
+        if (pmi){
+            pr_del_pmi(pmi);
+        }
+        return -1;
+    }
+    for (i = 0; i < n; i++){
+        PouchSegment *seg = &segs[i];
+        seg->failed = &failed;
+        seg->fd = fd;
+        seg->pos = size*i/n;
+        seg->end = size*(i + 1)/n;
+        prs[i] = doc_get_attachment(pr_init(), server, db, id, name);
+        snprintf(range, sizeof(range), "Range: bytes=%lld-%lld",
+                (long long)seg->pos, (long long)seg->end - 1);
+        pr_add_header(prs[i], range);
+        pr_add_header(prs[i], "Accept-Encoding: identity");	// ranges of the raw bytes
+        if (etag){	// a changed attachment comes back whole, as a 200
+            char *header = NULL;
+            header = combine(&header, "If-Range:", etag, " ");
+            pr_add_header(prs[i], header);
+            free(header);
+        }
+        pr_set_sink(prs[i], segment_sink, seg);
+        pr_set_done(prs[i], segment_done, seg);
+        pr_dopmi(prs[i], pmi);
+    }
+    event_base_dispatch(base);	// returns once every segment is done
+
+    for (i = 0; i < n; i++){
+        pr_free(prs[i]);
+    }
+    free(prs);
+    free(segs);
+    pr_del_pmi(pmi);
+    return failed ? -1 : 0;
+}
+
+// cuts the file to the size of the attachment just written, so nothing of
+// a longer earlier version (or of the failed segments) is left behind
+static long truncate_download(int fd, curl_off_t size){
+    if (ftruncate(fd, (off_t)size) != 0){
+        fprintf(stderr, "doc_download_attachment: truncate failed: %s\n",
+                strerror(errno));
+        return -1;
+    }
+    return (long)size;
+}
+
+long doc_download_attachment(char *server, char *db, char *id, char *name, int fd, int segments){
+    curl_off_t size = -1;
+    char *etag = NULL;
+    if (segments > 1){	// find the size, and whether ranges are supported
+        struct curl_header *h;
+        PouchReq *pr = doc_get_attachment(pr_init(), server, db, id, name);
+        pr_set_method(pr, HEAD);
+        pr_add_header(pr, "Accept-Encoding: identity");	// the size of the raw bytes
+        pr_do(pr);
+        if (pr->curlcode == CURLE_OK && pr->httpresponse == 200 &&
+                curl_easy_header(pr->easy, "Accept-Ranges", 0, CURLH_HEADER, -1, &h) == CURLHE_OK &&
+                !strcmp(h->value, "bytes")){
+            size = pr->hdrs.content_length;
+            if (pr->hdrs.etag){
+                etag = strdup(pr->hdrs.etag);
+            }
+        }
+        pr_free(pr);
+        if (size > 0 && size/segments < POUCH_SEGMENT_MIN){
+            segments = (int)(size/POUCH_SEGMENT_MIN);
+        }
+    }
+    if (segments > 1 && size > 0 &&
+            !fetch_segments(server, db, id, name, fd, segments, size, etag)){
+        free(etag);
+        return truncate_download(fd, size);
+    }
+    free(etag);
+
+    // a single stream, when ranges are no use or did not work out
+    size = -1;
+    PouchSegment whole;
+    int failed = 0;
+    memset(&whole, 0, sizeof(whole));
+    whole.failed = &failed;
+    whole.fd = fd;
+    whole.end = -1;
+    PouchReq *pr = doc_get_attachment(pr_init(), server, db, id, name);
+    pr_set_sink(pr, segment_sink, &whole);
+    pr_do(pr);
+    if (pr->curlcode == CURLE_OK && pr->httpresponse == 200 && !failed){
+        size = truncate_download(fd, whole.pos);
+    }
+    pr_free(pr);
+    return (long)size;
+}
+long doc_download_attachment_path(char *server, char *db, char *id, char *name, char *path, int segments){
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0){
+        fprintf(stderr, "doc_download_attachment: could not open file %s\n",
+                path);
+        return -1;
+    }
+    long size = doc_download_attachment(server, db, id, name, fd, segments);
+    if (close(fd) != 0){
+        size = -1;
+    }
+    return size;
+}
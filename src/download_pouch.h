@@ -0,0 +1,42 @@
+#ifndef __DOWNLOAD_POUCH_H__
+#define __DOWNLOAD_POUCH_H__
+
+// Standard libraries
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+// Pouch helpers
+#include "multi_pouch.h"
+
+// Defines
+#define POUCH_SEGMENT_MIN (4*1024*1024)	// smallest range worth its own request
+
+/*
+ * Attachment downloads that go straight to a file as the data arrives,
+ * instead of being collected in pr->resp.
+ *
+ * With segments > 1, a HEAD request finds the attachment's size first, and
+ * if the server takes Range requests the attachment is split into that many
+ * byte ranges (none smaller than POUCH_SEGMENT_MIN), fetched at the same time
+ * on their own PouchMInfo and written in place with pwrite(). If-Range with
+ * the attachment's ETag keeps the pieces from mixing two versions of it. If
+ * ranges are not supported, or any range fails, the attachment is fetched
+ * again in a single stream.
+ */
+
+/** Download attachment name of document id into fd, from offset 0, using up
+ *  to segments concurrent range requests. Runs its own event loop and
+ *  returns once done, with the number of bytes written, or -1 if the
+ *  download failed (the file may then hold part of the attachment). fd must
+ *  be a regular file; it is truncated to the attachment's size, so whatever
+ *  it held before does not linger past the end.
+ */
+long doc_download_attachment(char *server, char *db, char *id, char *name, int fd, int segments);
+
+/** Download an attachment as doc_download_attachment() does, into the file
+ *  at path, which is created or truncated
+ */
+long doc_download_attachment_path(char *server, char *db, char *id, char *name, char *path, int segments);
+
+#endif
@@ -0,0 +1,89 @@
+// Standard libraries
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "etag_pouch.h"
+#include "lru_pouch.h"
+
+// each entry holds the ETag, a '\0' and the body
+static PouchLRU *etag_lru = NULL;	// NULL while the cache is off
+
+int pouch_etag_cache(size_t budget){
+    if (budget == 0){
+        budget = POUCH_ETAG_CACHE_BYTES;
+    }
+    if (etag_lru){
+        lru_set_budget(etag_lru, budget);
+        return 0;
+    }
+    etag_lru = lru_new(budget);
+    return etag_lru ? 0 : -1;
+}
+void pouch_etag_cache_cleanup(void){
+    lru_free(etag_lru);
+    etag_lru = NULL;
+}
+
+// keeps a copy of the entry on the request, so that a 304 can still be
+// answered if the entry is evicted before the response arrives
+static void copy_entry(const char *val, size_t len, void *userp){
+    PouchReq *pr = (PouchReq *)userp;
+    pr->etag_entry = (char *)malloc(len);
+    if (pr->etag_entry){
+        memcpy(pr->etag_entry, val, len);
+        pr->etag_entry_len = len;
+    }
+}
+static void forget_entry(PouchReq *pr){
+    free(pr->etag_entry);
+    pr->etag_entry = NULL;
+    pr->etag_entry_len = 0;
+}
+void etag_cache_prepare(PouchReq *pr){
+    char *header = NULL;
+    forget_entry(pr);
+    if (!etag_lru || pr->sink || !pr->method || strcmp(pr->method, GET) ||
+            pr_has_header(pr, "If-None-Match:")){
+        return;
+    }
+    if (lru_get(etag_lru, pr->url, strlen(pr->url), copy_entry, pr) && pr->etag_entry){
+        header = combine(&header, "If-None-Match:", pr->etag_entry, " ");
+        pr_add_header(pr, header);
+        free(header);
+    }
+}
+
+void etag_cache_finish(PouchReq *pr){
+    if (pr->httpresponse == 304 && pr->etag_entry){
+        size_t etag_len = strlen(pr->etag_entry) + 1;
+        pr_set_resp(pr, pr->etag_entry + etag_len, pr->etag_entry_len - etag_len);
+        pr->httpresponse = 200;	// as if the body had been sent again
+        forget_entry(pr);
+        return;
+    }
+    forget_entry(pr);
+    if (!etag_lru || pr->sink || !pr->method || strcmp(pr->method, GET)){
+        return;
+    }
+    if (pr->httpresponse != 200){
+        return;
+    }
+    if (!pr->hdrs.etag){
+        lru_drop(etag_lru, pr->url, strlen(pr->url));	// the old one is stale
+        return;
+    }
+    size_t etag_len = strlen(pr->hdrs.etag) + 1;
+    size_t url_len = strlen(pr->url);
+    char *val = (char *)malloc(etag_len + pr->resp.size);
+    if (!val){
+        return;
+    }
+    memcpy(val, pr->hdrs.etag, etag_len);
+    if (pr->resp.size){
+        memcpy(val + etag_len, pr->resp.data, pr->resp.size);
+    }
+    lru_put(etag_lru, pr->url, url_len, val, etag_len + pr->resp.size,
+            url_len + etag_len + pr->resp.size);
+    free(val);
+}
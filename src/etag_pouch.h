@@ -0,0 +1,48 @@
+#ifndef __ETAG_POUCH_H__
+#define __ETAG_POUCH_H__
+
+// Standard libraries
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+// Pouch helpers
+#include "pouch.h"
+
+/*
+ * Process-wide cache of GET responses, keyed by URL. A response that came
+ * with an ETag is kept along with it; the next GET of the same URL sends
+ * If-None-Match, and if the server answers 304 Not Modified the cached body
+ * is put in pr->resp and httpresponse is set to 200, so an unchanged
+ * document or view costs only the headers. The server still checks every
+ * request, so a cached body is never returned without its say-so.
+ *
+ * Requests with a sink, and requests that set their own If-None-Match
+ * header, are left alone.
+ */
+
+#define POUCH_ETAG_CACHE_BYTES (16*1024*1024)	// default memory budget
+
+/** Turn on the ETag cache, keeping up to budget bytes of responses (0 for
+ *  POUCH_ETAG_CACHE_BYTES), least recently used first out. Call it again to
+ *  change the budget. Returns 0, or -1 if out of memory.
+ */
+int pouch_etag_cache(size_t budget);
+
+/** Turn off the ETag cache and free it. Call it only while no requests are
+ *  running.
+ */
+void pouch_etag_cache_cleanup(void);
+
+/** Add If-None-Match to a GET request if its URL is cached, and keep a copy
+ *  of the cached body on the request for the 304, since the entry may be
+ *  evicted before the response arrives. Called by pr_setup_easy().
+ */
+void etag_cache_prepare(PouchReq *pr);
+
+/** Store the body of a GET response that has an ETag, or answer a 304 from
+ *  the cache. Called by pr_do() and check_multi_info().
+ */
+void etag_cache_finish(PouchReq *pr);
+
+#endif
@@ -0,0 +1,132 @@
+// Standard libraries
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <pthread.h>
+
+#include "exec_pouch.h"
+
+// takes the oldest queued request, waiting for one; returns NULL once the
+// executor is stopping and the queue is empty
+static PouchFuture *pe_take(PouchExec *pe){
+    PouchFuture *fut;
+    pthread_mutex_lock(&pe->lock);
+    while (!pe->head && !pe->stopping){
+        pthread_cond_wait(&pe->work, &pe->lock);
+    }
+    fut = pe->head;
+    if (fut){
+        pe->head = fut->next;
+        if (!pe->head){
+            pe->tail = NULL;
+        }
+        fut->next = NULL;
+    }
+    pthread_mutex_unlock(&pe->lock);
+    return fut;
+}
+static void *pe_worker(void *data){
+    PouchExec *pe = (PouchExec *)data;
+    PouchFuture *fut;
+    while ((fut = pe_take(pe))){
+        pr_do(fut->pr);
+        pthread_mutex_lock(&fut->lock);
+        fut->done = 1;
+        pthread_cond_broadcast(&fut->cond);
+        pthread_mutex_unlock(&fut->lock);
+    }
+    return NULL;
+}
+
+PouchExec *pe_init(int n_threads){
+    int i;
+    if (pouch_global_init()){	// before any worker makes a handle
+        return NULL;
+    }
+    PouchExec *pe = (PouchExec *)calloc(1, sizeof(PouchExec));
+    if (!pe){
+        return NULL;
+    }
+    if (n_threads <= 0){
+        n_threads = POUCH_EXEC_THREADS;
+    }
+    pthread_mutex_init(&pe->lock, NULL);
+    pthread_cond_init(&pe->work, NULL);
+    pe->threads = (pthread_t *)calloc(n_threads, sizeof(pthread_t));
+    if (!pe->threads){
+        pe_free(pe);
+        return NULL;
+    }
+    for (i = 0; i < n_threads; i++){
+        if (pthread_create(&pe->threads[i], NULL, pe_worker, pe)){
+            fprintf(stderr, "pe_init: could not start worker thread %d\n", i);
+            break;
+        }
+        pe->n_threads++;
+    }
+    if (pe->n_threads == 0){
+        pe_free(pe);
+        return NULL;
+    }
+    return pe;
+}
+PouchFuture *pe_submit(PouchExec *pe, PouchReq *pr){
+    PouchFuture *fut = (PouchFuture *)calloc(1, sizeof(PouchFuture));
+    if (!fut){
+        return NULL;
+    }
+    fut->pr = pr;
+    pthread_mutex_init(&fut->lock, NULL);
+    pthread_cond_init(&fut->cond, NULL);
+    pthread_mutex_lock(&pe->lock);
+    if (pe->tail){
+        pe->tail->next = fut;
+    } else {
+        pe->head = fut;
+    }
+    pe->tail = fut;
+    pthread_cond_signal(&pe->work);
+    pthread_mutex_unlock(&pe->lock);
+    return fut;
+}
+int pe_poll(PouchFuture *fut){
+    int done;
+    pthread_mutex_lock(&fut->lock);
+    done = fut->done;
+    pthread_mutex_unlock(&fut->lock);
+    return done;
+}
+PouchReq *pe_wait(PouchFuture *fut){
+    pthread_mutex_lock(&fut->lock);
+    while (!fut->done){
+        pthread_cond_wait(&fut->cond, &fut->lock);
+    }
+    pthread_mutex_unlock(&fut->lock);
+    return fut->pr;
+}
+void pe_future_free(PouchFuture *fut){
+    if (!fut){
+        return;
+    }
+    pe_wait(fut);
+    pthread_cond_destroy(&fut->cond);
+    pthread_mutex_destroy(&fut->lock);
+    free(fut);
+}
+void pe_free(PouchExec *pe){
+    int i;
+    if (!pe){
+        return;
+    }
+    pthread_mutex_lock(&pe->lock);
+    pe->stopping = 1;	// workers drain the queue, then exit
+    pthread_cond_broadcast(&pe->work);
+    pthread_mutex_unlock(&pe->lock);
+    for (i = 0; i < pe->n_threads; i++){
+        pthread_join(pe->threads[i], NULL);
+    }
+    free(pe->threads);
+    pthread_cond_destroy(&pe->work);
+    pthread_mutex_destroy(&pe->lock);
+    free(pe);
+}
@@ -0,0 +1,76 @@
+#ifndef __EXEC_POUCH_H__
+#define __EXEC_POUCH_H__
+
+// Standard libraries
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <pthread.h>
+
+// Pouch helpers
+#include "pouch.h"
+
+// Defines
+#define POUCH_EXEC_THREADS 8	// default number of worker threads
+
+// Structs
+typedef struct _PouchExec PouchExec;
+typedef struct _PouchFuture PouchFuture;
+
+/** _PouchFuture
+ *
+ *  A request submitted to a PouchExec. Once it is done, pr holds the
+ *  response exactly as after pr_do().
+ */
+struct _PouchFuture {
+    PouchReq *pr;			// the request, still owned by the caller
+    int done;				// pr_do() has returned
+    pthread_mutex_t lock;
+    pthread_cond_t cond;	// signalled when done
+    PouchFuture *next;		// next request in the PouchExec's queue
+};
+
+/** _PouchExec
+ *
+ *  Runs PouchReqs with pr_do() on a fixed pool of worker threads, so plain
+ *  synchronous code can have many requests in flight at once: submit them
+ *  all, then wait for each. Requests are started in the order submitted.
+ */
+struct _PouchExec {
+    pthread_t *threads;
+    int n_threads;
+    PouchFuture *head;		// queued requests, oldest first
+    PouchFuture *tail;
+    int stopping;			// pe_free() was called
+    pthread_mutex_t lock;	// protects the queue and stopping
+    pthread_cond_t work;	// signalled when a request is queued
+};
+
+/** Start an executor with n_threads workers (0 for POUCH_EXEC_THREADS).
+ *  Returns NULL if the threads could not be started.
+ */
+PouchExec *pe_init(int n_threads);
+
+/** Queue pr to be made with pr_do() on a worker thread. pr must not be
+ *  touched until the future is done. Returns the future to wait on, or NULL
+ *  if out of memory.
+ */
+PouchFuture *pe_submit(PouchExec *pe, PouchReq *pr);
+
+/** Return 1 if the request is done, 0 if it is queued or running */
+int pe_poll(PouchFuture *fut);
+
+/** Block until the request is done and return it */
+PouchReq *pe_wait(PouchFuture *fut);
+
+/** Wait for the request if needed, then free the future (but not its
+ *  PouchReq)
+ */
+void pe_future_free(PouchFuture *fut);
+
+/** Finish every queued request, stop the workers and free the executor.
+ *  Futures stay valid and must still be freed with pe_future_free().
+ */
+void pe_free(PouchExec *pe);
+
+#endif
@@ -0,0 +1,293 @@
+// Standard libraries
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "fetch_pouch.h"
+
+/** PouchChunk
+ *
+ *  One request's worth of ids, kept until the response has been handled so
+ *  the chunk can be retried with _all_docs, and so ids the response did not
+ *  cover can be reported.
+ */
+typedef struct {
+    PouchFetch *pf;
+    char **ids;
+    char **revs;		// NULL if no revisions were requested
+    size_t n;
+    size_t done;		// documents delivered so far
+    int all_docs;		// fetched with _all_docs instead of _bulk_get
+    int no_db;			// the server said the database does not exist
+    ScanStream ss;		// splits the response into rows
+} PouchChunk;
+
+static void pf_destroy(PouchFetch *pf);
+
+static void chunk_free(PouchChunk *c){
+    size_t i;
+    for (i = 0; i < c->n; i++){
+        free(c->ids[i]);
+        if (c->revs){
+            free(c->revs[i]);
+        }
+    }
+    free(c->ids);
+    free(c->revs);
+    scan_reset(&c->ss);
+    free(c);
+}
+
+// Results
+static void pf_deliver(PouchChunk *c, const char *id, const char *json, size_t len, const char *error){
+    PouchFetch *pf = c->pf;
+    if (json){
+        pf->fetched++;
+    } else {
+        pf->failed++;
+    }
+    c->done++;
+    pf->cb(pf, id, json, len, error);
+}
+
+// handles one element of "results" (_bulk_get) or "rows" (_all_docs)
+static int chunk_row(ScanStream *ss, const char *key, int depth, const char *val, size_t len, void *userp){
+    PouchChunk *c = (PouchChunk *)userp;
+    const char *end = val + len;
+    size_t n;
+    if (depth == 1 && key && !strcmp(key, "reason")){	// an error response
+        char *reason = scan_strdup(val, len);
+        c->no_db = reason && !strcmp(reason, "Database does not exist.");
+        free(reason);
+        return 0;
+    }
+    if (depth != 2 || *val != '{' || c->done >= c->n){
+        return 0;	// total_rows and the like
+    }
+    char *id = c->ids[c->done];	// rows come back in the order requested
+    if (c->all_docs){
+        const char *doc = scan_member(val, end, "doc", &n);
+        char *error = scan_member_dup(val, len, "error");
+        if (doc && *doc == '{'){
+            pf_deliver(c, id, doc, n, NULL);
+        } else {
+            pf_deliver(c, id, NULL, 0, error ? error : "deleted");
+        }
+        free(error);
+        return 0;
+    }
+    const char *docs = scan_member(val, end, "docs", &n);
+    const char *el = NULL;
+    size_t el_len;
+    // one element per revision; only the first is passed on
+    if (docs && (el = scan_element(docs, docs + n, NULL, &el_len))){
+        const char *ok = scan_member(el, el + el_len, "ok", &n);
+        if (ok){
+            pf_deliver(c, id, ok, n, NULL);
+        } else {
+            const char *err = scan_member(el, el + el_len, "error", &n);
+            char *error = err ? scan_member_dup(err, n, "error") : NULL;
+            pf_deliver(c, id, NULL, 0, error ? error : "unknown_error");
+            free(error);
+        }
+    }
+    return 0;
+}
+static size_t chunk_sink(PouchReq *pr, char *data, size_t len, void *userp){
+    PouchChunk *c = (PouchChunk *)userp;
+    return scan_feed(&c->ss, data, len) == 0 ? len : 0;
+}
+
+// Requests
+static int body_append(char **buf, size_t *len, size_t *alloc, const char *str){
+    size_t length = strlen(str);
+    if (*len + length + 1 > *alloc){
+        size_t size = *alloc ? *alloc : 1024;
+        while (size < *len + length + 1){
+            size *= 2;
+        }
+        char *b = (char *)realloc(*buf, size);
+        if (!b){
+            return -1;
+        }
+        *buf = b;
+        *alloc = size;
+    }
+    memcpy(*buf + *len, str, length + 1);
+    *len += length;
+    return 0;
+}
+static PouchReq *chunk_request(PouchChunk *c, PouchReq *pr){
+    PouchFetch *pf = c->pf;
+    char *body = NULL;
+    size_t len = 0, alloc = 0, i;
+    body_append(&body, &len, &alloc, c->all_docs ? "{\"keys\":[" : "{\"docs\":[");
+    for (i = 0; i < c->n; i++){
+        char *id = scan_quote(c->ids[i]);
+        if (i > 0){
+            body_append(&body, &len, &alloc, ",");
+        }
+        if (c->all_docs){
+            body_append(&body, &len, &alloc, id);
+        } else {
+            body_append(&body, &len, &alloc, "{\"id\":");
+            body_append(&body, &len, &alloc, id);
+            if (c->revs && c->revs[i]){
+                char *rev = scan_quote(c->revs[i]);
+                body_append(&body, &len, &alloc, ",\"rev\":");
+                body_append(&body, &len, &alloc, rev);
+                free(rev);
+            }
+            body_append(&body, &len, &alloc, "}");
+        }
+        free(id);
+    }
+    body_append(&body, &len, &alloc, "]}");
+
+    pr_set_method(pr, POST);
+    pr_set_url(pr, pf->server);
+    pr->url = combine(&(pr->url), pr->url, pf->db, "/");
+    if (c->all_docs){
+        pr->url = combine(&(pr->url), pr->url, "_all_docs", "/");
+        pr_add_param(pr, "include_docs", "true");
+    } else {
+        pr->url = combine(&(pr->url), pr->url, "_bulk_get", "/");
+    }
+    pr_set_prdata(pr, body, len);
+    scan_reset(&c->ss);
+    c->no_db = 0;
+    pr_set_sink(pr, chunk_sink, c);
+    return pr;
+}
+
+// reports every document the chunk has not delivered yet as failed
+static void chunk_fail(PouchChunk *c, const char *error){
+    while (c->done < c->n){
+        pf_deliver(c, c->ids[c->done], NULL, 0, error);
+    }
+}
+
+// Looks at a finished chunk. Returns 1 if it has to be sent again with
+// _all_docs, and otherwise reports anything the response left out.
+static int chunk_finish(PouchChunk *c, PouchReq *pr){
+    PouchFetch *pf = c->pf;
+    int ok = pr->curlcode == CURLE_OK && pr->httpresponse == 200;
+    // servers without _bulk_get refuse the method, or treat it as a
+    // document id and answer 404 for a database that does exist
+    if (!c->all_docs && !ok && c->done == 0 && pr->curlcode == CURLE_OK &&
+            (pr->httpresponse == 405 || pr->httpresponse == 501 ||
+             (pr->httpresponse == 404 && !c->no_db))){
+        pf->bulk_get = 0;
+        if (c->revs){	// _all_docs would quietly return the current revisions
+            chunk_fail(c, POUCH_FETCH_NO_REVS);
+            return 0;
+        }
+        c->all_docs = 1;
+        return 1;
+    }
+    chunk_fail(c, pr->curlcode != CURLE_OK ?
+            curl_easy_strerror(pr->curlcode) : ok ? "not_found" : "request_failed");
+    return 0;
+}
+static void chunk_done(PouchReq *pr, PouchMInfo *pmi){
+    PouchChunk *c = (PouchChunk *)pr->custom;
+    PouchFetch *pf = c->pf;
+    if (chunk_finish(c, pr)){
+        pr_dopmi(chunk_request(c, pr), pmi);
+        return;
+    }
+    chunk_free(c);
+    pr_free(pr);
+    if (--pf->in_flight == 0 && pf->freed){
+        pf_destroy(pf);
+    }
+}
+
+// PouchFetch functions
+PouchFetch *pf_init(char *server, char *db, PouchMInfo *pmi, pf_doc_cb cb, void *custom){
+    PouchFetch *pf = (PouchFetch *)calloc(1, sizeof(PouchFetch));
+    if (!pf){
+        return NULL;
+    }
+    pf->server = strdup(server);
+    pf->db = strdup(db);
+    pf->pmi = pmi;
+    pf->cb = cb;
+    pf->custom = custom;
+    pf->chunk = POUCH_FETCH_CHUNK;
+    pf->bulk_get = 1;
+    if (!pmi){
+        pf->pr = pr_init();
+    }
+    return pf;
+}
+PouchFetch *pf_set_options(PouchFetch *pf, size_t chunk, int bulk_get){
+    if (chunk){
+        pf->chunk = chunk;
+    }
+    pf->bulk_get = bulk_get;
+    return pf;
+}
+int pf_get(PouchFetch *pf, char **ids, char **revs, size_t n){
+    size_t start, i;
+    for (start = 0; start < n; start += pf->chunk){
+        PouchChunk *c = (PouchChunk *)calloc(1, sizeof(PouchChunk));
+        if (!c){
+            return -1;
+        }
+        c->pf = pf;
+        c->n = n - start < pf->chunk ? n - start : pf->chunk;
+        c->ids = (char **)calloc(c->n, sizeof(char *));
+        c->revs = revs ? (char **)calloc(c->n, sizeof(char *)) : NULL;
+        if (!c->ids || (revs && !c->revs)){
+            c->n = 0;
+            chunk_free(c);
+            return -1;
+        }
+        for (i = 0; i < c->n; i++){
+            c->ids[i] = strdup(ids[start + i]);
+            if (revs && revs[start + i]){
+                c->revs[i] = strdup(revs[start + i]);
+            }
+        }
+        c->all_docs = !pf->bulk_get;
+        scan_init(&c->ss, 2, chunk_row, c);
+        if (c->all_docs && c->revs){	// the server can't fetch given revisions
+            chunk_fail(c, POUCH_FETCH_NO_REVS);
+            chunk_free(c);
+            continue;
+        }
+
+        if (pf->pmi){
+            PouchReq *pr = chunk_request(c, pr_init());
+            pr_set_done(pr, chunk_done, c);
+            pf->in_flight++;
+            pr_dopmi(pr, pf->pmi);
+        } else {
+            do {
+                pr_do(chunk_request(c, pf->pr));
+            } while (chunk_finish(c, pf->pr));
+            pr_set_sink(pf->pr, NULL, NULL);
+            chunk_free(c);
+        }
+    }
+    return 0;
+}
+static void pf_destroy(PouchFetch *pf){
+    if (pf->pr){
+        pr_free(pf->pr);
+    }
+    free(pf->server);
+    free(pf->db);
+    free(pf);
+}
+void pf_free(PouchFetch *pf){
+    if (!pf){
+        return;
+    }
+    if (pf->in_flight > 0){	// the last chunk to finish frees it
+        pf->freed = 1;
+        return;
+    }
+    pf_destroy(pf);
+}
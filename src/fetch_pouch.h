@@ -0,0 +1,81 @@
+#ifndef __FETCH_POUCH_H__
+#define __FETCH_POUCH_H__
+
+// Standard libraries
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+// Pouch helpers
+#include "multi_pouch.h"
+#include "scan_pouch.h"
+
+// Defines
+#define POUCH_FETCH_CHUNK 500	// default most documents per request
+#define POUCH_FETCH_NO_REVS "bulk_get_unsupported"	// error for revisions without _bulk_get
+
+// Structs
+typedef struct _PouchFetch PouchFetch;
+
+/** pf_doc_cb
+ *
+ *  Called once for every document requested from a PouchFetch, in the order
+ *  they were requested within each chunk. json/len is the document, or NULL
+ *  if it could not be fetched, in which case error says why ("not_found",
+ *  "deleted", POUCH_FETCH_NO_REVS, or the reason the request failed). None
+ *  of the strings are valid after the callback returns.
+ */
+typedef void (*pf_doc_cb)(PouchFetch *pf, const char *id, const char *json, size_t len, const char *error);
+
+/** _PouchFetch
+ *
+ *  Fetches many documents with a few requests instead of one doc_get() per
+ *  id. The ids are split into chunks, and each chunk is fetched with one
+ *  _bulk_get POST, or a POST to _all_docs with keys and include_docs=true on
+ *  servers that don't have _bulk_get (this is detected from a 405 or 501, or
+ *  a 404 for a database that exists, and remembered). Responses are parsed
+ *  as they arrive, so documents reach the callback without the whole chunk
+ *  being held in memory.
+ *
+ *  Without a PouchMInfo, chunks are fetched one after another with pr_do().
+ *  With one, all the chunks are started at once on its event loop.
+ */
+struct _PouchFetch {
+    char *server;
+    char *db;
+    PouchMInfo *pmi;	// event loop to fetch on, or NULL for pr_do()
+    PouchReq *pr;		// request reused for every pr_do() chunk
+    pf_doc_cb cb;		// USER DEFINED callback for each document
+    void *custom;		// USER DEFINED pointer to some data
+    size_t chunk;		// most documents per request
+    int bulk_get;		// 1 to use _bulk_get, 0 once the server lacked it
+    int in_flight;		// chunks started on the PouchMInfo, not yet done
+    int freed;			// pf_free() was called while chunks were in flight
+    long fetched;		// documents delivered
+    long failed;		// documents that could not be fetched
+};
+
+/** Create a fetcher for documents of db. pmi may be NULL to fetch with
+ *  pr_do().
+ */
+PouchFetch *pf_init(char *server, char *db, PouchMInfo *pmi, pf_doc_cb cb, void *custom);
+
+/** Set the most documents per request, and whether to try _bulk_get at all
+ *  (turn it off for servers known not to have it)
+ */
+PouchFetch *pf_set_options(PouchFetch *pf, size_t chunk, int bulk_get);
+
+/** Fetch n documents. revs may be NULL, or hold a revision (or NULL) for
+ *  each id; revisions need _bulk_get, so on a server without it every
+ *  document of such a call fails with POUCH_FETCH_NO_REVS rather than
+ *  coming back at its current revision. The ids are copied. Without a
+ *  PouchMInfo this returns once every document has been delivered. Returns 0, or -1 if out of memory.
+ */
+int pf_get(PouchFetch *pf, char **ids, char **revs, size_t n);
+
+/** Free the fetcher. With a PouchMInfo, chunks in flight still deliver
+ *  their documents and the fetcher is freed after the last one.
+ */
+void pf_free(PouchFetch *pf);
+
+#endif
@@ -0,0 +1,199 @@
+// Standard libraries
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <pthread.h>
+
+#include "lru_pouch.h"
+
+/** LRUEntry
+ *
+ *  A cached value, in both a hash chain and the LRU list. The key and value
+ *  are stored right after the struct.
+ */
+typedef struct _LRUEntry LRUEntry;
+struct _LRUEntry {
+    unsigned long hash;
+    size_t key_len;
+    size_t len;			// length of the value
+    size_t cost;
+    LRUEntry *chain;	// next entry in the same hash bucket
+    LRUEntry *newer;	// LRU list, most recently used at the head
+    LRUEntry *older;
+};
+#define ENTRY_KEY(e) ((char *)((e) + 1))
+#define ENTRY_VAL(e) (ENTRY_KEY(e) + (e)->key_len)
+
+struct _PouchLRU {
+    pthread_mutex_t lock;
+    LRUEntry **table;
+    size_t buckets;		// always a power of 2
+    size_t count;		// number of entries
+    size_t cost;		// total cost of the entries
+    size_t budget;		// most total cost allowed
+    LRUEntry *newest;
+    LRUEntry *oldest;
+};
+
+static unsigned long hash_str(const char *s, size_t len){
+    unsigned long h = 2166136261UL;	// FNV-1a
+    size_t i;
+    for (i = 0; i < len; i++){
+        h = (h ^ (unsigned char)s[i])*16777619UL;
+    }
+    return h;
+}
+
+// All of the following are called with the lock held
+
+static void list_unlink(PouchLRU *lru, LRUEntry *e){
+    if (e->newer){
+        e->newer->older = e->older;
+    } else {
+        lru->newest = e->older;
+    }
+    if (e->older){
+        e->older->newer = e->newer;
+    } else {
+        lru->oldest = e->newer;
+    }
+    e->newer = e->older = NULL;
+}
+static void list_push(PouchLRU *lru, LRUEntry *e){
+    e->newer = NULL;
+    e->older = lru->newest;
+    if (lru->newest){
+        lru->newest->newer = e;
+    }
+    lru->newest = e;
+    if (!lru->oldest){
+        lru->oldest = e;
+    }
+}
+static LRUEntry **find_slot(PouchLRU *lru, const char *key, size_t key_len, unsigned long hash){
+    LRUEntry **p = &lru->table[hash & (lru->buckets - 1)];
+    while (*p && ((*p)->hash != hash || (*p)->key_len != key_len ||
+                memcmp(ENTRY_KEY(*p), key, key_len))){
+        p = &(*p)->chain;
+    }
+    return p;
+}
+static void remove_entry(PouchLRU *lru, LRUEntry **slot){
+    LRUEntry *e = *slot;
+    *slot = e->chain;
+    list_unlink(lru, e);
+    lru->count--;
+    lru->cost -= e->cost;
+    free(e);
+}
+static void evict(PouchLRU *lru){
+    while (lru->cost > lru->budget && lru->oldest){
+        LRUEntry *e = lru->oldest;
+        remove_entry(lru, find_slot(lru, ENTRY_KEY(e), e->key_len, e->hash));
+    }
+}
+// doubles the hash table once there are more entries than buckets
+static void grow(PouchLRU *lru){
+    size_t buckets = 2*lru->buckets, i;
+    LRUEntry **table = (LRUEntry **)calloc(buckets, sizeof(LRUEntry *));
+    if (!table){
+        return;	// chains just get longer
+    }
+    for (i = 0; i < lru->buckets; i++){
+        LRUEntry *e = lru->table[i];
+        while (e){
+            LRUEntry *next = e->chain;
+            e->chain = table[e->hash & (buckets - 1)];
+            table[e->hash & (buckets - 1)] = e;
+            e = next;
+        }
+    }
+    free(lru->table);
+    lru->table = table;
+    lru->buckets = buckets;
+}
+
+// PouchLRU functions
+PouchLRU *lru_new(size_t budget){
+    PouchLRU *lru = (PouchLRU *)calloc(1, sizeof(PouchLRU));
+    if (!lru){
+        return NULL;
+    }
+    lru->buckets = 64;
+    lru->table = (LRUEntry **)calloc(lru->buckets, sizeof(LRUEntry *));
+    if (!lru->table){
+        free(lru);
+        return NULL;
+    }
+    lru->budget = budget;
+    pthread_mutex_init(&lru->lock, NULL);
+    return lru;
+}
+void lru_free(PouchLRU *lru){
+    if (!lru){
+        return;
+    }
+    lru->budget = 0;
+    evict(lru);
+    pthread_mutex_destroy(&lru->lock);
+    free(lru->table);
+    free(lru);
+}
+void lru_set_budget(PouchLRU *lru, size_t budget){
+    pthread_mutex_lock(&lru->lock);
+    lru->budget = budget;
+    evict(lru);
+    pthread_mutex_unlock(&lru->lock);
+}
+int lru_put(PouchLRU *lru, const char *key, size_t key_len, const char *val, size_t len, size_t cost){
+    if (cost > lru->budget){
+        lru_drop(lru, key, key_len);	// an older, smaller value would be stale
+        return 0;
+    }
+    LRUEntry *e = (LRUEntry *)malloc(sizeof(LRUEntry) + key_len + len);
+    if (!e){
+        return -1;
+    }
+    e->hash = hash_str(key, key_len);
+    e->key_len = key_len;
+    e->len = len;
+    e->cost = cost;
+    memcpy(ENTRY_KEY(e), key, key_len);
+    memcpy(ENTRY_VAL(e), val, len);
+
+    pthread_mutex_lock(&lru->lock);
+    LRUEntry **slot = find_slot(lru, key, key_len, e->hash);
+    if (*slot){
+        remove_entry(lru, slot);
+    }
+    e->chain = *slot;
+    *slot = e;
+    list_push(lru, e);
+    lru->count++;
+    lru->cost += cost;
+    evict(lru);
+    if (lru->count > lru->buckets){
+        grow(lru);
+    }
+    pthread_mutex_unlock(&lru->lock);
+    return 0;
+}
+int lru_get(PouchLRU *lru, const char *key, size_t key_len, lru_copy_cb cb, void *userp){
+    pthread_mutex_lock(&lru->lock);
+    LRUEntry *e = *find_slot(lru, key, key_len, hash_str(key, key_len));
+    if (e){
+        list_unlink(lru, e);
+        list_push(lru, e);
+        cb(ENTRY_VAL(e), e->len, userp);
+    }
+    pthread_mutex_unlock(&lru->lock);
+    return e != NULL;
+}
+void lru_drop(PouchLRU *lru, const char *key, size_t key_len){
+    pthread_mutex_lock(&lru->lock);
+    LRUEntry **slot = find_slot(lru, key, key_len, hash_str(key, key_len));
+    if (*slot){
+        remove_entry(lru, slot);
+    }
+    pthread_mutex_unlock(&lru->lock);
+}
@@ -0,0 +1,49 @@
+#ifndef __LRU_POUCH_H__
+#define __LRU_POUCH_H__
+
+// Standard libraries
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+/*
+ * Thread-safe map from strings to blobs of bytes that forgets the least
+ * recently used entries once their total cost exceeds a budget. Used by the
+ * revision cache (a cost of 1 per entry) and the ETag cache (a cost of the
+ * entry's size in bytes).
+ */
+
+// Structs
+typedef struct _PouchLRU PouchLRU;
+
+/** lru_copy_cb
+ *
+ *  Receives a value found by lru_get(). It runs with the cache locked, so it
+ *  should copy what it needs and return quickly.
+ */
+typedef void (*lru_copy_cb)(const char *val, size_t len, void *userp);
+
+/** Create an empty cache whose entries may cost budget in total */
+PouchLRU *lru_new(size_t budget);
+
+/** Free a cache and all of its entries */
+void lru_free(PouchLRU *lru);
+
+/** Change a cache's budget, forgetting entries until it is met */
+void lru_set_budget(PouchLRU *lru, size_t budget);
+
+/** Store a copy of val/len under key/key_len, replacing any older value.
+ *  Entries that cost more than the whole budget are not stored. Returns 0,
+ *  or -1 if out of memory.
+ */
+int lru_put(PouchLRU *lru, const char *key, size_t key_len, const char *val, size_t len, size_t cost);
+
+/** Look up key/key_len and hand its value to cb, marking it as recently
+ *  used. Returns 1 if it was found and 0 if not.
+ */
+int lru_get(PouchLRU *lru, const char *key, size_t key_len, lru_copy_cb cb, void *userp);
+
+/** Forget key/key_len */
+void lru_drop(PouchLRU *lru, const char *key, size_t key_len);
+
+#endif
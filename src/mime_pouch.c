@@ -0,0 +1,259 @@
+// Standard libraries
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "mime_pouch.h"
+
+#define OCTET_STREAM "application/octet-stream"
+#define MAX_EXT 8		// longer extensions are not looked up
+#define EXT_SLOTS 256	// hash slots, at least twice the table's size
+
+/** MimeMagic
+ *
+ *  A signature: len bytes at offset off identify type, if check (when set)
+ *  agrees with the rest of the header. Weak signatures are also found at
+ *  the start of ordinary text, so a known extension overrides them.
+ */
+typedef struct {
+    size_t off;
+    const char *magic;
+    size_t len;
+    const char *type;
+    int (*check)(const unsigned char *data, size_t len);
+    int weak;
+} MimeMagic;
+
+static unsigned int le32(const unsigned char *p){
+    return p[0] | p[1] << 8 | p[2] << 16 | (unsigned int)p[3] << 24;
+}
+static unsigned int be32(const unsigned char *p){
+    return (unsigned int)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+}
+
+// "BM" only starts a bitmap if the reserved words are zero and the DIB
+// header that follows the 14-byte file header has one of the known sizes
+static int check_bmp(const unsigned char *data, size_t len){
+    if (len < 18 || le32(data + 6) != 0){
+        return 0;
+    }
+    switch (le32(data + 14)){
+        case 12: case 40: case 52: case 56: case 64: case 108: case 124:
+            return 1;
+    }
+    return 0;
+}
+
+// a ROOT file goes on with a big-endian version and fBEGIN, which is
+// always 100
+static int check_root(const unsigned char *data, size_t len){
+    return len >= 12 && data[4] == 0 && be32(data + 8) == 100;
+}
+
+// an ISO base media file ("ftyp" box) says what it holds with the major
+// brand that follows; brands is a run of four-character codes
+static int ftyp_brand(const unsigned char *data, size_t len, const char *brands){
+    if (len < 12){
+        return 0;
+    }
+    for (; *brands; brands += 4){
+        if (!memcmp(data + 8, brands, 4)){
+            return 1;
+        }
+    }
+    return 0;
+}
+static int check_mp4(const unsigned char *data, size_t len){
+    return ftyp_brand(data, len, "isomiso2iso4iso5iso6mp41mp42avc1dashM4V mmp4");
+}
+static int check_quicktime(const unsigned char *data, size_t len){
+    return ftyp_brand(data, len, "qt  ");
+}
+static int check_m4a(const unsigned char *data, size_t len){
+    return ftyp_brand(data, len, "M4A M4B ");
+}
+static int check_heic(const unsigned char *data, size_t len){
+    return ftyp_brand(data, len, "heicheixhevchevxmif1");
+}
+static int check_avif(const unsigned char *data, size_t len){
+    return ftyp_brand(data, len, "avifavis");
+}
+
+#define MAGIC(off, s, type) { off, s, sizeof(s) - 1, type, NULL, 0 }
+#define MAGIC_CHECK(off, s, type, check) { off, s, sizeof(s) - 1, type, check, 0 }
+#define MAGIC_WEAK(off, s, type) { off, s, sizeof(s) - 1, type, NULL, 1 }
+static const MimeMagic magics[] = {
+    MAGIC(0, "\x89PNG\r\n\x1a\n", "image/png"),
+    MAGIC(0, "\xff\xd8\xff", "image/jpeg"),
+    MAGIC(0, "GIF87a", "image/gif"),
+    MAGIC(0, "GIF89a", "image/gif"),
+    MAGIC(0, "II*\0", "image/tiff"),
+    MAGIC(0, "MM\0*", "image/tiff"),
+    MAGIC_CHECK(0, "BM", "image/bmp", check_bmp),
+    MAGIC(8, "WEBP", "image/webp"),
+    MAGIC(8, "WAVE", "audio/wav"),
+    MAGIC(8, "AVI ", "video/x-msvideo"),
+    MAGIC_CHECK(4, "ftyp", "video/mp4", check_mp4),
+    MAGIC_CHECK(4, "ftyp", "video/quicktime", check_quicktime),
+    MAGIC_CHECK(4, "ftyp", "audio/mp4", check_m4a),
+    MAGIC_CHECK(4, "ftyp", "image/heic", check_heic),
+    MAGIC_CHECK(4, "ftyp", "image/avif", check_avif),
+    MAGIC(0, "OggS", "audio/ogg"),
+    MAGIC(0, "fLaC", "audio/flac"),
+    MAGIC(0, "ID3", "audio/mpeg"),
+    MAGIC(0, "%PDF-", "application/pdf"),
+    MAGIC(0, "%!PS", "application/postscript"),
+    MAGIC(0, "PK\x03\x04", "application/zip"),
+    MAGIC(0, "\x1f\x8b", "application/gzip"),
+    MAGIC(0, "BZh", "application/x-bzip2"),
+    MAGIC(0, "\xfd" "7zXZ\0", "application/x-xz"),
+    MAGIC(0, "7z\xbc\xaf\x27\x1c", "application/x-7z-compressed"),
+    MAGIC(257, "ustar", "application/x-tar"),
+    MAGIC(0, "\x7f" "ELF", "application/x-executable"),
+    MAGIC_CHECK(0, "root", "application/x-root", check_root),
+    MAGIC(0, "\x89HDF\r\n\x1a\n", "application/x-hdf5"),
+    MAGIC(0, "SIMPLE  =", "application/fits"),
+    MAGIC_WEAK(0, "<?xml", "application/xml"),	// also SVG, XHTML, ...
+};
+#undef MAGIC
+#undef MAGIC_CHECK
+#undef MAGIC_WEAK
+
+/** MimeExt
+ *
+ *  A file name extension, lower case and without the dot, and its type
+ */
+typedef struct {
+    const char *ext;
+    const char *type;
+} MimeExt;
+
+static const MimeExt exts[] = {
+    { "jpg", "image/jpeg" }, { "jpeg", "image/jpeg" }, { "png", "image/png" },
+    { "gif", "image/gif" }, { "tif", "image/tiff" }, { "tiff", "image/tiff" },
+    { "bmp", "image/bmp" }, { "webp", "image/webp" }, { "ico", "image/x-icon" },
+    { "svg", "image/svg+xml" },
+    { "txt", "text/plain" }, { "text", "text/plain" }, { "log", "text/plain" },
+    { "md", "text/plain" }, { "rst", "text/plain" }, { "c", "text/plain" },
+    { "h", "text/plain" }, { "cc", "text/plain" }, { "cpp", "text/plain" },
+    { "cxx", "text/plain" }, { "hh", "text/plain" }, { "hpp", "text/plain" },
+    { "py", "text/plain" }, { "sh", "text/plain" }, { "tex", "text/plain" },
+    { "yaml", "text/plain" }, { "yml", "text/plain" }, { "ini", "text/plain" },
+    { "cfg", "text/plain" }, { "conf", "text/plain" },
+    { "csv", "text/csv" }, { "tsv", "text/tab-separated-values" },
+    { "html", "text/html" }, { "htm", "text/html" }, { "css", "text/css" },
+    { "js", "application/javascript" }, { "json", "application/json" },
+    { "xml", "application/xml" }, { "pdf", "application/pdf" },
+    { "ps", "application/postscript" }, { "eps", "application/postscript" },
+    { "zip", "application/zip" }, { "gz", "application/gzip" },
+    { "tgz", "application/gzip" }, { "bz2", "application/x-bzip2" },
+    { "xz", "application/x-xz" }, { "7z", "application/x-7z-compressed" },
+    { "tar", "application/x-tar" }, { "root", "application/x-root" },
+    { "h5", "application/x-hdf5" }, { "hdf5", "application/x-hdf5" },
+    { "fits", "application/fits" }, { "wav", "audio/wav" },
+    { "mp3", "audio/mpeg" }, { "ogg", "audio/ogg" }, { "flac", "audio/flac" },
+    { "m4a", "audio/mp4" }, { "mp4", "video/mp4" }, { "m4v", "video/mp4" },
+    { "avi", "video/x-msvideo" }, { "mov", "video/quicktime" },
+    { "mkv", "video/x-matroska" }, { "heic", "image/heic" },
+    { "avif", "image/avif" },
+};
+
+static const MimeExt *ext_table[EXT_SLOTS];	// open addressing into exts
+static pthread_once_t ext_once = PTHREAD_ONCE_INIT;
+
+static unsigned int ext_hash(const char *ext){
+    unsigned int h = 2166136261U;	// FNV-1a
+    while (*ext){
+        h = (h ^ (unsigned char)*ext++)*16777619U;
+    }
+    return h;
+}
+static void ext_table_init(void){
+    size_t i;
+    for (i = 0; i < sizeof(exts)/sizeof(exts[0]); i++){
+        unsigned int slot = ext_hash(exts[i].ext) % EXT_SLOTS;
+        while (ext_table[slot]){
+            slot = (slot + 1) % EXT_SLOTS;
+        }
+        ext_table[slot] = &exts[i];
+    }
+}
+
+// the type for filename's extension, or NULL
+static const char *ext_type(const char *filename){
+    char ext[MAX_EXT];
+    const char *base = strrchr(filename, '/');
+    const char *dot = strrchr(base ? base : filename, '.');
+    size_t i, len;
+    if (!dot || (len = strlen(++dot)) == 0 || len >= MAX_EXT){
+        return NULL;
+    }
+    for (i = 0; i <= len; i++){
+        ext[i] = tolower((unsigned char)dot[i]);
+    }
+    pthread_once(&ext_once, ext_table_init);
+    unsigned int slot = ext_hash(ext) % EXT_SLOTS;
+    while (ext_table[slot]){
+        if (!strcmp(ext_table[slot]->ext, ext)){
+            return ext_table[slot]->type;
+        }
+        slot = (slot + 1) % EXT_SLOTS;
+    }
+    return NULL;
+}
+
+// the signature data starts with, or NULL
+static const MimeMagic *magic_find(const unsigned char *data, size_t len){
+    size_t i;
+    for (i = 0; i < sizeof(magics)/sizeof(magics[0]); i++){
+        const MimeMagic *m = &magics[i];
+        if (m->off + m->len <= len && !memcmp(data + m->off, m->magic, m->len) &&
+                (!m->check || m->check(data, len))){
+            return m;
+        }
+    }
+    return NULL;
+}
+
+// data with no NULs and few control characters is taken for text
+static int looks_like_text(const unsigned char *data, size_t len){
+    size_t i, odd = 0;
+    for (i = 0; i < len; i++){
+        if (data[i] == '\0'){
+            return 0;
+        }
+        if (data[i] < 0x20 && !isspace(data[i]) && data[i] != '\b' && data[i] != 0x1b){
+            odd++;
+        }
+    }
+    return odd*10 < len;
+}
+
+const char *pouch_mime_type(const char *filename, const void *data, size_t len){
+    const MimeMagic *magic = NULL;
+    const char *type = NULL;
+    if (data && len){
+        magic = magic_find((const unsigned char *)data, len);
+    }
+    if (magic && !magic->weak){
+        return magic->type;
+    }
+    if (filename){
+        type = ext_type(filename);
+    }
+    if (!type && magic){
+        type = magic->type;
+    }
+    if (!type && data && len){
+        type = looks_like_text((const unsigned char *)data, len) ? "text/plain" : NULL;
+    }
+    return type ? type : OCTET_STREAM;
+}
+const char *pouch_mime_type_fd(const char *filename, int fd){
+    unsigned char buf[POUCH_SNIFF_BYTES];
+    ssize_t len = pread(fd, buf, sizeof(buf), 0);
+    return pouch_mime_type(filename, buf, len > 0 ? (size_t)len : 0);
+}
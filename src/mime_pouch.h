@@ -0,0 +1,32 @@
+#ifndef __MIME_POUCH_H__
+#define __MIME_POUCH_H__
+
+// Standard libraries
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+/*
+ * Content-Type detection for attachment uploads, without running file(1).
+ * The first bytes of the data are checked against the signatures of common
+ * binary formats; failing that, the file name's extension is looked up in a
+ * hashed table; failing that, data that looks like text is text/plain and
+ * anything else application/octet-stream. Signatures that ordinary text may
+ * start with (such as "<?xml", which SVG files begin with too) only count
+ * when the extension is unknown.
+ */
+
+#define POUCH_SNIFF_BYTES 512	// bytes of data looked at for a signature
+
+/** Return the Content-Type for data/len (which may be just its first
+ *  POUCH_SNIFF_BYTES, or NULL/0 if unknown) named filename (which may be
+ *  NULL). The string is static.
+ */
+const char *pouch_mime_type(const char *filename, const void *data, size_t len);
+
+/** Return the Content-Type for the open file fd named filename, reading its
+ *  first bytes with pread(), which leaves its file offset alone
+ */
+const char *pouch_mime_type_fd(const char *filename, int fd);
+
+#endif
@@ -6,6 +6,11 @@
 #include <stdio.h>
 #include <fcntl.h>
 #include <time.h>
+#include <errno.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
 
 // Libevent and Libcurl
 #include <event.h>
@@ -19,76 +24,80 @@
 #include <curl/curl.h>
 
 #include "multi_pouch.h"
+#include "rev_pouch.h"
+#include "etag_pouch.h"
+#include "session_pouch.h"
 
 // PouchReq functions
-PouchReq *pr_domulti(PouchReq *pr, CURLM *multi){
+static void pr_multi_start(PouchReq *pr, CURLM *multi){
     // empty the response buffer
-    if (pr->resp.data){
-        free(pr->resp.data);
-    }
-    pr->resp.data = NULL;
-    pr->resp.size = 0;
-
-    // initialize the CURL object
-    if (pr->easy){ // get rid of the old one?
-        printf("EXISTING EASY\n");
-        curl_multi_remove_handle(multi, pr->easy);
-        curl_easy_cleanup(pr->easy);
-    }
-    pr->easy = curl_easy_init();
+    pr_clear_resp(pr);
     pr->multi = multi;
 
     // setup the CURL object/request
-    curl_easy_setopt(pr->easy, CURLOPT_USERAGENT, "pouch/0.1");            // add user-agent
-    curl_easy_setopt(pr->easy, CURLOPT_URL, pr->url);                      // where to send this request
+    pr_setup_easy(pr, pr->easy);
     curl_easy_setopt(pr->easy, CURLOPT_CONNECTTIMEOUT, 2);                 // Timeouts
-    curl_easy_setopt(pr->easy, CURLOPT_TIMEOUT, 2);
-    curl_easy_setopt(pr->easy, CURLOPT_NOSIGNAL, 1);
-    curl_easy_setopt(pr->easy, CURLOPT_WRITEFUNCTION, recv_data_callback); // where to store the response
-    curl_easy_setopt(pr->easy, CURLOPT_WRITEDATA, (void *)pr);
+    curl_easy_setopt(pr->easy, CURLOPT_TIMEOUT, pr->sink ? 0L : 2L);         // streams have no time limit
     curl_easy_setopt(pr->easy, CURLOPT_PRIVATE, (void *)pr);               // associate this request with the PouchReq holding it
     curl_easy_setopt(pr->easy, CURLOPT_NOPROGRESS, 1L);                    // Don't use a progress function to watch this request
     curl_easy_setopt(pr->easy, CURLOPT_ERRORBUFFER, pr->errorstr);         // Store multi error descriptions in pr->errorstr
 
-    // if there's a valid auth string, use it
-    if(pr->usrpwd){
-        curl_easy_setopt(pr->easy, CURLOPT_USERPWD, pr->usrpwd);
+    // start the request by adding it to the multi handle
+    pr->curlmcode = curl_multi_add_handle(pr->multi, pr->easy);
+    //printf("pr->curlmcode = %d\n", pr->curlmcode);
+    if (pr->curlmcode != CURLM_RECURSIVE_API_CALL){ // pr_dopmi defers those
+        debug_mcode("pr_domulti: ", pr->curlmcode);
     }
+}
 
-    // check for data upload
-    if (pr->req.data && pr->req.size > 0){
-        //printf("--> %s\n", pr->req.data);
-        // let CURL know what data to send
-        curl_easy_setopt(pr->easy, CURLOPT_READFUNCTION, send_data_callback);
-        curl_easy_setopt(pr->easy, CURLOPT_READDATA, (void *)pr);
+// adds the requests started from inside libcurl callbacks
+static void defer_cb(int fd, short kind, void *userp){
+    PouchMInfo *pmi = (PouchMInfo *)userp;
+    PouchReq *pr;
+    while ((pr = pmi->deferred)){
+        pmi->deferred = pr->next;
+        pr->next = NULL;
+        pr->curlmcode = curl_multi_add_handle(pmi->multi, pr->easy);
+        debug_mcode("defer_cb: ", pr->curlmcode);
     }
+    pmi->deferred_tail = NULL;
+}
 
-    if (!strncmp(pr->method, PUT, 3)){ // PUT-specific option
-        curl_easy_setopt(pr->easy, CURLOPT_UPLOAD, 1);
-        // Note: Content-Type: application/json is automatically assumed
-    }
-    else if (!strncmp(pr->method, POST, 4)){ // POST-specific options
-        curl_easy_setopt(pr->easy, CURLOPT_POST, 1);
-        pr_add_header(pr, "Content-Type: application/json");
+// takes an easy handle that is no longer in use by a PouchReq, ready to be
+// handed out again by pmi_get_easy
+static void pmi_put_easy(PouchMInfo *pmi, CURL *easy){
+    if (pmi->pool_count == pmi->pool_size){ // grow the pool
+        int size = pmi->pool_size ? 2*pmi->pool_size : 16;
+        CURL **pool = (CURL **)realloc(pmi->easy_pool, size*sizeof(CURL *));
+        if (!pool){
+            curl_easy_cleanup(easy);
+            return;
+        }
+        pmi->easy_pool = pool;
+        pmi->pool_size = size;
     }
+    curl_easy_reset(easy); // forget the old request's options
+    pmi->easy_pool[pmi->pool_count++] = easy;
+}
 
-    if (!strncmp(pr->method, HEAD, 4)){ // HEAD-specific options
-        curl_easy_setopt(pr->easy, CURLOPT_NOBODY, 1); // no body to this request, just a head
-        curl_easy_setopt(pr->easy, CURLOPT_HEADER, 1); // includes header in body output (for debugging)
-    } // THIS FIXED HEAD REQUESTS
-    else {
-        curl_easy_setopt(pr->easy, CURLOPT_CUSTOMREQUEST, pr->method);
-    } 
-
-    // add the custom headers
-    pr_add_header(pr, "Transfer-Encoding: chunked");
-    curl_easy_setopt(pr->easy, CURLOPT_HTTPHEADER, pr->headers);
-
-    // start the request by adding it to the multi handle
-    pr->curlmcode = curl_multi_add_handle(pr->multi, pr->easy);
-    //printf("pr->curlmcode = %d\n", pr->curlmcode);
-    debug_mcode("pr_domulti: ", pr->curlmcode);
+static CURL *pmi_get_easy(PouchMInfo *pmi){
+    if (pmi->pool_count > 0){
+        return pmi->easy_pool[--pmi->pool_count];
+    }
+    return curl_easy_init();
+}
 
+PouchReq *pr_domulti(PouchReq *pr, CURLM *multi){
+    // initialize the CURL object, reusing the request's old one if possible
+    if (pr->easy){
+        if (pr->multi){
+            curl_multi_remove_handle(pr->multi, pr->easy);
+        }
+        curl_easy_reset(pr->easy);
+    } else {
+        pr->easy = curl_easy_init();
+    }
+    pr_multi_start(pr, multi);
     return pr;
     /*
        if (pr->headers){
@@ -109,6 +118,288 @@ PouchReq *pr_domulti(PouchReq *pr, CURLM *multi){
     */
 }
 
+// starts a request that has been given a slot
+static void pmi_start_now(PouchReq *pr, PouchMInfo *pmi){
+    if (pr->easy){ // the request already owns a handle, so use that one
+        if (pr->multi){
+            curl_multi_remove_handle(pr->multi, pr->easy);
+        }
+        curl_easy_reset(pr->easy);
+    } else {
+        pr->easy = pmi_get_easy(pmi);
+    }
+    if (pmi->http_version != POUCH_HTTP1){ // share a connection with other requests
+        curl_easy_setopt(pr->easy, CURLOPT_HTTP_VERSION,
+                pmi->http_version == POUCH_HTTP2_PRIOR_KNOWLEDGE ?
+                CURL_HTTP_VERSION_2_PRIOR_KNOWLEDGE : CURL_HTTP_VERSION_2TLS);
+        curl_easy_setopt(pr->easy, CURLOPT_PIPEWAIT, 1L);
+    }
+    pr_multi_start(pr, pmi->multi);
+    if (pr->curlmcode == CURLM_RECURSIVE_API_CALL){ // called from a libcurl callback
+        struct timeval now = {0, 0};
+        pr->next = NULL;
+        if (pmi->deferred_tail){
+            pmi->deferred_tail->next = pr;
+        } else {
+            pmi->deferred = pr;
+        }
+        pmi->deferred_tail = pr;
+        if (pmi->backend == POUCH_BACKEND_LIBEVENT){	// pmi_loop and pmi_process add them themselves
+            evtimer_add(&pmi->defer_event, &now);
+        }
+    }
+}
+
+// takes pr out of a list linked through pr->next; returns 1 if it was there
+static int list_remove(PouchReq **head, PouchReq **tail, PouchReq *pr){
+    PouchReq **p;
+    for (p = head; *p; p = &(*p)->next){
+        if (*p == pr){
+            *p = pr->next;
+            pr->next = NULL;
+            *tail = NULL;
+            for (PouchReq *q = *head; q; q = q->next){
+                *tail = q;
+            }
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// starts the requests held for the session cookie once the login is done.
+// Those turned away with 401 still have their handle and are sent again as
+// they are; the others have not been set up yet.
+static void session_login_done(PouchReq *login, PouchMInfo *pmi){
+    PouchReq *pr;
+    session_login_finish(login);
+    pr_free(login);
+    pmi->session_login = NULL;
+    while ((pr = pmi->session_waiting)){
+        pmi->session_waiting = pr->next;
+        pr->next = NULL;
+        if (pr->easy && pr->multi == pmi->multi){
+            session_resend_cookie(pr, -1);
+            pr->curlmcode = curl_multi_add_handle(pmi->multi, pr->easy);
+            debug_mcode("session_login_done: ", pr->curlmcode);
+        } else {
+            pmi_start_now(pr, pmi);
+        }
+    }
+    pmi->session_waiting_tail = NULL;
+}
+
+// holds pr until the session cookie is renewed, logging in if pmi is not
+// doing so already
+static void session_wait(PouchReq *pr, PouchMInfo *pmi){
+    pr->next = NULL;
+    if (pmi->session_waiting_tail){
+        pmi->session_waiting_tail->next = pr;
+    } else {
+        pmi->session_waiting = pr;
+    }
+    pmi->session_waiting_tail = pr;
+    if (!pmi->session_login){
+        PouchReq *login = pr_set_done(pr_init(), session_login_done, NULL);
+        pmi->session_login = login;
+        if (session_login_request(login)){
+            pmi_start_now(login, pmi);
+        } else {	// logged out meanwhile
+            session_login_done(login, pmi);
+        }
+    }
+}
+
+// starts a request, unless it has to wait for a new session cookie
+static void pmi_start(PouchReq *pr, PouchMInfo *pmi){
+    if (session_needs_login(pr)){
+        if (pr->easy && pr->multi){ // set up again once the cookie is there
+            curl_multi_remove_handle(pr->multi, pr->easy);
+        }
+        pr->multi = NULL;
+        session_wait(pr, pmi);
+        return;
+    }
+    pmi_start_now(pr, pmi);
+}
+// returns the in-flight count of the host pr->url points to, adding the
+// host if create is set. Hosts are few, so a linear search will do.
+static PouchHost *pmi_host(PouchMInfo *pmi, const char *url, int create){
+    const char *p = strstr(url, "://");
+    size_t len = p ? strcspn(p + 3, "/?#") + (p + 3 - url) : strlen(url);
+    int i;
+    for (i = 0; i < pmi->host_count; i++){
+        if (strlen(pmi->hosts[i].name) == len && !strncmp(pmi->hosts[i].name, url, len)){
+            return &pmi->hosts[i];
+        }
+    }
+    if (!create){
+        return NULL;
+    }
+    if (pmi->host_count == pmi->host_size){ // grow the host list
+        int size = pmi->host_size ? 2*pmi->host_size : 8;
+        PouchHost *hosts = (PouchHost *)realloc(pmi->hosts, size*sizeof(PouchHost));
+        if (!hosts){
+            return NULL;
+        }
+        pmi->hosts = hosts;
+        pmi->host_size = size;
+    }
+    PouchHost *host = &pmi->hosts[pmi->host_count];
+    host->name = strndup(url, len);
+    if (!host->name){
+        return NULL;
+    }
+    host->inflight = 0;
+    pmi->host_count++;
+    return host;
+}
+
+// whether pmi_set_limits() leaves room to start pr now
+static int pmi_has_slot(PouchMInfo *pmi, PouchReq *pr){
+    if (pmi->max_inflight > 0 && pmi->inflight >= pmi->max_inflight){
+        return 0;
+    }
+    if (pmi->max_host_inflight > 0){
+        PouchHost *host = pmi_host(pmi, pr->url, 0);
+        if (host && host->inflight >= pmi->max_host_inflight){
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// takes a slot and starts pr in it
+static void pmi_start_counted(PouchReq *pr, PouchMInfo *pmi){
+    PouchHost *host = pmi_host(pmi, pr->url, 1);
+    pmi->inflight++;
+    if (host){
+        host->inflight++;
+    }
+    pr->admitted = 1;
+    pmi_start(pr, pmi);
+}
+
+// starts the oldest waiting requests that now have a slot
+static void pmi_start_pending(PouchMInfo *pmi){
+    PouchReq **p = &pmi->pending;
+    PouchReq *pr;
+    pmi->pending_tail = NULL;
+    while ((pr = *p)){
+        if (pmi->max_inflight > 0 && pmi->inflight >= pmi->max_inflight){
+            break;
+        }
+        if (pmi_has_slot(pmi, pr)){
+            *p = pr->next;
+            pr->next = NULL;
+            pr->queued = 0;
+            pmi->pending_count--;
+            pmi_start_counted(pr, pmi);
+        } else {
+            pmi->pending_tail = pr;
+            p = &pr->next;
+        }
+    }
+    for (pr = *p; pr; pr = pr->next){ // the rest keep waiting
+        pmi->pending_tail = pr;
+    }
+}
+
+// gives back the slot of a request that finished or was cancelled; the
+// caller then starts whatever waits for it with pmi_start_pending. Requests
+// started without pmi_admit (pr_domulti on pmi->multi) never took one.
+static void pmi_release(PouchMInfo *pmi, PouchReq *pr){
+    if (!pr->admitted){
+        return;
+    }
+    pr->admitted = 0;
+    PouchHost *host = pmi_host(pmi, pr->url, 0);
+    if (pmi->inflight > 0){
+        pmi->inflight--;
+    }
+    if (host && host->inflight > 0){
+        host->inflight--;
+    }
+}
+
+// starts pr or puts it at the end of the queue; bounded requests are
+// refused when the queue is full
+static int pmi_admit(PouchReq *pr, PouchMInfo *pmi, int bounded){
+    if (pr->queued){ // already waiting; linking it again would corrupt the queue
+        return POUCH_QUEUED;
+    }
+    if (pr->easy && pr->multi == pmi->multi){ // restarted while running
+        pmi_release(pmi, pr);
+    }
+    // every waiting request that could run was started when its slot freed
+    // up, so a request with a slot does not jump ahead of any of them
+    if (pmi_has_slot(pmi, pr)){
+        pmi_start_counted(pr, pmi);
+        return POUCH_STARTED;
+    }
+    if (bounded && pmi->max_pending > 0 && pmi->pending_count >= pmi->max_pending){
+        return POUCH_QUEUE_FULL;
+    }
+    pr->next = NULL;
+    if (pmi->pending_tail){
+        pmi->pending_tail->next = pr;
+    } else {
+        pmi->pending = pr;
+    }
+    pmi->pending_tail = pr;
+    pmi->pending_count++;
+    pr->queued = 1;
+    return POUCH_QUEUED;
+}
+
+PouchReq *pr_dopmi(PouchReq *pr, PouchMInfo *pmi){
+    pmi_admit(pr, pmi, 0);
+    return pr;
+}
+
+int pmi_submit(PouchReq *pr, PouchMInfo *pmi){
+    return pmi_admit(pr, pmi, 1);
+}
+
+void pmi_set_limits(PouchMInfo *pmi, int max_inflight, int max_host_inflight, int max_pending){
+    pmi->max_inflight = max_inflight;
+    pmi->max_host_inflight = max_host_inflight;
+    pmi->max_pending = max_pending;
+    if (pmi->pending){ // raised limits may free slots
+        pmi_start_pending(pmi);
+    }
+}
+
+PouchReq *pr_set_done(PouchReq *pr, pr_proc_cb done, void *custom){
+    pr->done = done;
+    pr->custom = custom;
+    return pr;
+}
+void pr_cancel(PouchReq *pr, PouchMInfo *pmi){
+    if (list_remove(&pmi->pending, &pmi->pending_tail, pr)){ // still waiting for a slot
+        pr->queued = 0;
+        pmi->pending_count--;
+    }
+    list_remove(&pmi->deferred, &pmi->deferred_tail, pr); // not added to the multi yet
+    list_remove(&pmi->session_waiting, &pmi->session_waiting_tail, pr); // waiting for a login
+    if (pr->easy && pr->multi == pmi->multi){
+        curl_multi_remove_handle(pmi->multi, pr->easy);
+        pmi_put_easy(pmi, pr->easy);
+        pr->easy = NULL;
+        pr->multi = NULL;
+    }
+    if (pr->admitted){
+        pmi_release(pmi, pr);
+        if (pmi->pending){
+            pmi_start_pending(pmi);
+        }
+    }
+    if (pr->headers){
+        curl_slist_free_all(pr->headers); // free headers
+        pr->headers = NULL;
+    }
+}
+
 
 // libevent/libcurl multi interface helpers and callbacks
 void debug_mcode(const char *desc, CURLMcode code){
@@ -137,6 +428,9 @@ void debug_mcode(const char *desc, CURLMcode code){
             case CURLM_BAD_SOCKET:
                 s="CURLM_BAD_SOCKET";
                 break;
+            case CURLM_RECURSIVE_API_CALL:
+                s="CURLM_RECURSIVE_API_CALL";
+                break;
             default:
                 s="CURLM_unknown";
         }
@@ -144,12 +438,28 @@ void debug_mcode(const char *desc, CURLMcode code){
     }
 }
 
+// adds a finished request to the batch handed to pmi->batch_cb
+static void batch_add(PouchMInfo *pmi, PouchReq *pr){
+    if (pmi->batch_count == pmi->batch_size){ // grow the batch
+        int size = pmi->batch_size ? 2*pmi->batch_size : 16;
+        PouchReq **batch = (PouchReq **)realloc(pmi->batch, size*sizeof(PouchReq *));
+        if (!batch){
+            pmi->batch_cb(&pr, 1, pmi); // deliver it on its own
+            return;
+        }
+        pmi->batch = batch;
+        pmi->batch_size = size;
+    }
+    pmi->batch[pmi->batch_count++] = pr;
+}
+
 void check_multi_info(PouchMInfo *pmi /*, function pointer process_func*/){
     CURLMsg *msg;
     CURL *easy;
     CURLcode res;
 
     int msgs_left;
+    int gen;
     PouchReq *pr;
 
     while ((msg = curl_multi_info_read(pmi->multi, &msgs_left))){
@@ -159,8 +469,46 @@ void check_multi_info(PouchMInfo *pmi /*, function pointer process_func*/){
             res = msg->data.result;
             curl_easy_getinfo(easy, CURLINFO_PRIVATE, &pr);
             //printf("Finished request (easy=%p, url=%s)\n", easy, pr->url);
+            pr->curlcode = res;
+            if (res == CURLE_OK && (gen = session_expired(pr))){	// the session had expired
+                curl_multi_remove_handle(pmi->multi, easy);
+                if (session_resend_cookie(pr, gen)){	// renewed meanwhile
+                    pr->curlmcode = curl_multi_add_handle(pmi->multi, easy);
+                } else {
+                    session_wait(pr, pmi);
+                }
+                continue;
+            }
+            if (res == CURLE_OK){
+                curl_easy_getinfo(easy, CURLINFO_RESPONSE_CODE, &pr->httpresponse);
+                rev_cache_update(pr);
+                etag_cache_finish(pr);
+                session_finish(pr);
+            } else {
+                pr->httpresponse = 500;
+            }
+            if (pr->headers){
+                curl_slist_free_all(pr->headers); // free headers
+                pr->headers = NULL;
+            }
+            // give the easy handle back to the pool, and its slot to the
+            // next waiting request
+            curl_multi_remove_handle(pmi->multi, easy);
+            pmi_release(pmi, pr);
+            pr->easy = NULL;
+            pr->multi = NULL;
+            pmi_put_easy(pmi, easy);
+            if (pmi->pending){
+                pmi_start_pending(pmi);
+            }
             // process the result
-            if(pmi->has_cb){
+            if(pr->done){
+                pr->done(pr, pmi);
+            }
+            else if(pmi->batch_cb){
+                batch_add(pmi, pr);
+            }
+            else if(pmi->has_cb){
                 pmi->cb(pr, pmi);
             }
             else {
@@ -168,11 +516,30 @@ void check_multi_info(PouchMInfo *pmi /*, function pointer process_func*/){
             }
         }
     }
+    if (pmi->batch_count > 0){
+        int n = pmi->batch_count;
+        pmi->batch_count = 0;
+        pmi->batch_cb(pmi->batch, n, pmi);
+    }
 }
 
 int multi_timer_cb(CURLM *multi, long timeout_ms, void *data){
     PouchMInfo *pmi = (PouchMInfo *)data;
     struct timeval timeout;
+    if (pmi->backend == POUCH_BACKEND_EPOLL){
+        struct itimerspec its;
+        memset(&its, 0, sizeof(its));	// -1 disarms the timer
+        if (timeout_ms >= 0){
+            its.it_value.tv_sec = timeout_ms/1000;
+            its.it_value.tv_nsec = (timeout_ms%1000)*1000000;
+            if (timeout_ms == 0){
+                its.it_value.tv_nsec = 1;	// a zero it_value would disarm it too
+            }
+        }
+        timerfd_settime(pmi->timerfd, 0, &its, NULL);
+        pmi->timer_armed = timeout_ms >= 0;
+        return 0;
+    }
     timeout.tv_sec = timeout_ms/1000;
     timeout.tv_usec = (timeout_ms%1000)*1000;
     //fprintf(stderr, "multi_timer_cb: Setting timeout to %ld ms\n", timeout_ms);
@@ -193,12 +560,13 @@ void event_cb(int fd, short kind, void *userp){
 
     debug_mcode("event_cb: curl_multi_socket_action", rc);
 
-    check_multi_info(pmi);
     if (pmi->still_running <= 0){ // last transfer is done
         if (evtimer_pending(&pmi->timer_event, NULL)){
             evtimer_del(&pmi->timer_event); // get rid of the libevent timer
         }
     }
+    // after the timer is gone, so requests started by callbacks keep theirs
+    check_multi_info(pmi);
 }
 
 void timer_cb(int fd, short kind, void *userp){
@@ -253,32 +621,183 @@ int sock_cb(CURL *e, curl_socket_t s, int action, void *cbp, void *sockp){
     return 0;
 }
 
-PouchMInfo *pr_mk_pmi(struct event_base *base, struct evdns_base *dns_base, pr_proc_cb callback, void *custom){
+// the CURLMOPT_SOCKETFUNCTION of the epoll backend. sockp is only used to
+// remember that a socket is already in the epoll set.
+static int epoll_sock_cb(CURL *e, curl_socket_t s, int action, void *cbp, void *sockp){
+    PouchMInfo *pmi = (PouchMInfo *)cbp;
+    struct epoll_event ev;
+    if (action == CURL_POLL_REMOVE){
+        epoll_ctl(pmi->epfd, EPOLL_CTL_DEL, s, NULL);
+        return 0;
+    }
+    memset(&ev, 0, sizeof(ev));
+    ev.events =
+        (action&CURL_POLL_IN ? EPOLLIN:0)|
+        (action&CURL_POLL_OUT ? EPOLLOUT:0);	// level-triggered, see pr_mk_pmi_epoll
+    ev.data.fd = s;
+    if (sockp){
+        epoll_ctl(pmi->epfd, EPOLL_CTL_MOD, s, &ev);
+    }
+    else {
+        if (epoll_ctl(pmi->epfd, EPOLL_CTL_ADD, s, &ev) < 0 && errno == EEXIST){
+            epoll_ctl(pmi->epfd, EPOLL_CTL_MOD, s, &ev);
+        }
+        curl_multi_assign(pmi->multi, s, pmi);
+    }
+    return 0;
+}
+
+// allocates a PouchMInfo with the options common to both backends
+static PouchMInfo *pmi_alloc(pr_proc_cb callback, void *custom){
+    pouch_global_init();
     PouchMInfo *pmi = (PouchMInfo *)malloc(sizeof(PouchMInfo));
     if(!pmi){
         return NULL;
     }
     memset(pmi, 0, sizeof(*pmi));
-    pmi->base = base;
-    pmi->dnsbase = dns_base;
     pmi->still_running = 0;
+    pmi->http_version = POUCH_HTTP1;
     pmi->has_cb = 0;
     if (callback){
         pmi->cb = callback; // set the callback function
         pmi->has_cb = 1;
     }
     pmi->custom = custom;
+    pmi->epfd = -1;
+    pmi->timerfd = -1;
     pmi->multi = curl_multi_init();
+    curl_multi_setopt(pmi->multi, CURLMOPT_SOCKETDATA, pmi);
+    curl_multi_setopt(pmi->multi, CURLMOPT_TIMERFUNCTION, multi_timer_cb);
+    curl_multi_setopt(pmi->multi, CURLMOPT_TIMERDATA, pmi);
+    return pmi;
+}
+
+PouchMInfo *pr_mk_pmi(struct event_base *base, struct evdns_base *dns_base, pr_proc_cb callback, void *custom){
+    PouchMInfo *pmi = pmi_alloc(callback, custom);
+    if(!pmi){
+        return NULL;
+    }
+    pmi->backend = POUCH_BACKEND_LIBEVENT;
+    pmi->base = base;
+    pmi->dnsbase = dns_base;
     evtimer_set(&pmi->timer_event, timer_cb, (void *)pmi);
     event_base_set(pmi->base, &pmi->timer_event);
+    evtimer_set(&pmi->defer_event, defer_cb, (void *)pmi);
+    event_base_set(pmi->base, &pmi->defer_event);
     // setup the generic multi interface options we want
     curl_multi_setopt(pmi->multi, CURLMOPT_SOCKETFUNCTION, sock_cb);
-    curl_multi_setopt(pmi->multi, CURLMOPT_SOCKETDATA, pmi);
-    curl_multi_setopt(pmi->multi, CURLMOPT_TIMERFUNCTION, multi_timer_cb);
-    curl_multi_setopt(pmi->multi, CURLMOPT_TIMERDATA, pmi);
     //curl_multi_setopt(pmi->multi, CURLMOPT_MAXCONNECTS, 20); // arbitrary
     return pmi;
 }
+
+PouchMInfo *pr_mk_pmi_epoll(pr_proc_cb callback, void *custom){
+    struct epoll_event ev;
+    PouchMInfo *pmi = pmi_alloc(callback, custom);
+    if(!pmi){
+        return NULL;
+    }
+    pmi->backend = POUCH_BACKEND_EPOLL;
+    pmi->epfd = epoll_create1(EPOLL_CLOEXEC);
+    pmi->timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK|TFD_CLOEXEC);
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.fd = pmi->timerfd;
+    if (pmi->epfd < 0 || pmi->timerfd < 0 ||
+            epoll_ctl(pmi->epfd, EPOLL_CTL_ADD, pmi->timerfd, &ev) < 0){
+        pr_del_pmi(pmi);
+        return NULL;
+    }
+    curl_multi_setopt(pmi->multi, CURLMOPT_SOCKETFUNCTION, epoll_sock_cb);
+    return pmi;
+}
+
+// one round of the epoll backend: waits up to timeout_ms for events (-1
+// for as long as it takes), handles them and the requests that finished.
+// Returns 1 while requests remain, 0 once none do, or -1 on error.
+static int pmi_round(PouchMInfo *pmi, int timeout_ms){
+    struct epoll_event events[POUCH_EPOLL_EVENTS];
+    uint64_t expirations;
+    CURLMcode rc;
+    int i, n, action;
+    if (pmi->backend != POUCH_BACKEND_EPOLL){
+        return -1;
+    }
+    defer_cb(-1, 0, pmi); // requests started from inside libcurl callbacks
+    if (pmi->still_running <= 0 && !pmi->timer_armed && !pmi->pending){
+        return 0; // every request has finished
+    }
+    n = epoll_wait(pmi->epfd, events, POUCH_EPOLL_EVENTS, timeout_ms);
+    if (n < 0){
+        return errno == EINTR ? 1 : -1;
+    }
+    for (i = 0; i < n; i++){
+        if (events[i].data.fd == pmi->timerfd){
+            read(pmi->timerfd, &expirations, sizeof(expirations)); // clear it
+            pmi->timer_armed = 0;
+            rc = curl_multi_socket_action(pmi->multi, CURL_SOCKET_TIMEOUT, 0, &pmi->still_running);
+            debug_mcode("pmi_round: curl_multi_socket_action", rc);
+        }
+        else {
+            action =
+                (events[i].events & EPOLLIN ? CURL_CSELECT_IN : 0) |
+                (events[i].events & EPOLLOUT ? CURL_CSELECT_OUT : 0) |
+                (events[i].events & (EPOLLERR|EPOLLHUP) ? CURL_CSELECT_ERR : 0);
+            rc = curl_multi_socket_action(pmi->multi, events[i].data.fd, action, &pmi->still_running);
+            debug_mcode("pmi_round: curl_multi_socket_action", rc);
+        }
+    }
+    check_multi_info(pmi); // once for everything that happened in this round
+    return pmi->still_running > 0 || pmi->timer_armed || pmi->deferred || pmi->pending;
+}
+
+int pmi_loop(PouchMInfo *pmi){
+    int rc = 1;
+    pmi->loop_break = 0;
+    while (rc > 0 && !pmi->loop_break){
+        rc = pmi_round(pmi, -1);
+    }
+    return rc < 0 ? -1 : 0;
+}
+
+int pmi_process(PouchMInfo *pmi){
+    return pmi_round(pmi, 0);
+}
+
+int pmi_fd(PouchMInfo *pmi){
+    return pmi->backend == POUCH_BACKEND_EPOLL ? pmi->epfd : -1;
+}
+
+long pmi_timeout(PouchMInfo *pmi){
+    long timeout_ms = -1;
+    if (pmi->deferred){
+        return 0;
+    }
+    curl_multi_timeout(pmi->multi, &timeout_ms);
+    return timeout_ms;
+}
+
+void pmi_set_batch_cb(PouchMInfo *pmi, pmi_batch_cb cb){
+    pmi->batch_cb = cb;
+}
+
+void pmi_loopbreak(PouchMInfo *pmi){
+    pmi->loop_break = 1;
+}
+
+void pmi_set_http2(PouchMInfo *pmi, int mode, long max_host_conns, long max_streams, long max_conns){
+    pmi->http_version = mode;
+    curl_multi_setopt(pmi->multi, CURLMOPT_PIPELINING,
+            mode == POUCH_HTTP1 ? CURLPIPE_NOTHING : CURLPIPE_MULTIPLEX);
+    if (max_host_conns > 0){
+        curl_multi_setopt(pmi->multi, CURLMOPT_MAX_HOST_CONNECTIONS, max_host_conns);
+    }
+    if (max_streams > 0){
+        curl_multi_setopt(pmi->multi, CURLMOPT_MAX_CONCURRENT_STREAMS, max_streams);
+    }
+    if (max_conns > 0){
+        curl_multi_setopt(pmi->multi, CURLMOPT_MAXCONNECTS, max_conns);
+    }
+}
 /*
    void pmi_multi_cleanup(CURLM *multi){
    printf("inside pmi_multi_cleanup\n");
@@ -330,13 +849,31 @@ void pmi_multi_cleanup(PouchMInfo *pmi){
 
 void pr_del_pmi(PouchMInfo *pmi){
     if(pmi){
-        printf("pmi %p exists!\n", pmi);
-        event_del(&pmi->timer_event); // TODO: figure out how to check if this is valid
+        //printf("pmi %p exists!\n", pmi);
+        if (pmi->backend == POUCH_BACKEND_LIBEVENT){
+            event_del(&pmi->timer_event); // TODO: figure out how to check if this is valid
+            event_del(&pmi->defer_event);
+        }
+        while(pmi->pool_count > 0){ // clean up the pooled easy handles
+            curl_easy_cleanup(pmi->easy_pool[--pmi->pool_count]);
+        }
+        free(pmi->easy_pool);
+        free(pmi->batch);
+        for (int i = 0; i < pmi->host_count; i++){
+            free(pmi->hosts[i].name);
+        }
+        free(pmi->hosts);
         if(pmi->multi){
-            printf("pmi %p multi %p exists!\n", pmi, pmi->multi);
+            //printf("pmi %p multi %p exists!\n", pmi, pmi->multi);
             //pmi_multi_cleanup(pmi);
             curl_multi_cleanup(pmi->multi);
         }
+        if (pmi->epfd >= 0){	// after the multi, whose cleanup removes its sockets
+            close(pmi->epfd);
+        }
+        if (pmi->timerfd >= 0){
+            close(pmi->timerfd);
+        }
         if(pmi->dnsbase){
             evdns_base_free(pmi->dnsbase, 0);
         } if (pmi->base){
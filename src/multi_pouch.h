@@ -25,26 +25,34 @@
 #include "pouch.h"
 
 // Defines
-#define USE_SYS_FILE 0
 #define GET "GET"
 #define PUT "PUT"
 #define POST "POST"
 #define HEAD "HEAD"
 #define COPY "COPY"
 #define DELETE "DELETE"
+#define POUCH_HTTP1 0					// one connection per in-flight request
+#define POUCH_HTTP2 1					// multiplex over HTTP/2 on https:// URLs
+#define POUCH_HTTP2_PRIOR_KNOWLEDGE 2	// multiplex over cleartext HTTP/2 (h2c)
+#define POUCH_BACKEND_LIBEVENT 0		// sockets and timers are libevent events
+#define POUCH_BACKEND_EPOLL 1			// sockets and a timerfd in an epoll set, run by pmi_loop
+#define POUCH_EPOLL_EVENTS 64			// events pmi_loop takes from epoll_wait at once
+#define POUCH_STARTED 0					// pmi_submit: the request is running
+#define POUCH_QUEUED 1					// ... it waits for an in-flight slot
+#define POUCH_QUEUE_FULL -1				// ... it was not accepted; retry later
 
 // Structs
 typedef struct _SockInfo SockInfo;
-typedef struct _PouchMInfo PouchMInfo;
+typedef struct _PouchHost PouchHost;
 
-/** pr_proc_cb
+/** pmi_batch_cb
  *
- *  Callback function for processing finished PouchReqs
- *
- *  If a pr_proc_cb is set by the user, that function becomes responsible for
- *  pr_free()'ing the received PouchReq.
+ *  Receives the n requests that finished in one round of the event loop,
+ *  instead of one pr_proc_cb call for each. As with a pr_proc_cb, the
+ *  callback is responsible for pr_free()'ing them; the array itself belongs
+ *  to the PouchMInfo and is reused after the callback returns.
  */
-typedef void (*pr_proc_cb)(PouchReq *, PouchMInfo *);
+typedef void (*pmi_batch_cb)(PouchReq **reqs, size_t n, PouchMInfo *pmi);
 
 /** SockInfo
  *
@@ -61,6 +69,16 @@ struct _SockInfo {
     int action;           // what action libcurl wants done
 };
 
+/** _PouchHost
+ *
+ *  Number of requests a PouchMInfo has in flight to one server, for the
+ *  per-host limit of pmi_set_limits().
+ */
+struct _PouchHost {
+    char *name;			// scheme, host and port, as in "http://127.0.0.1:5984"
+    int inflight;		// requests to it started and not finished
+};
+
 /** _PouchMInfo
  *
  *  Holds values necessary for using libevent with libcurl; used for the multi
@@ -78,10 +96,98 @@ struct _PouchMInfo {
     pr_proc_cb cb;		// USER DEFINED pointer to a callback function for processing finished PouchReqs
     int has_cb;			// ... tests for existence of callback function
     void *custom;				// USER DEFINED pointer to some data. 
+    CURL **easy_pool;			// easy handles ready to be reused by pr_dopmi
+    int pool_count;				// ... number of handles in the pool
+    int pool_size;				// ... number of handles the pool has room for
+    int http_version;			// POUCH_HTTP1, POUCH_HTTP2 or POUCH_HTTP2_PRIOR_KNOWLEDGE
+    PouchReq *deferred;			// requests started from inside a libcurl callback,
+    PouchReq *deferred_tail;	// ... which may not add handles to the multi itself
+    struct event defer_event;	// ... adds them once the callback has returned
+    int backend;				// POUCH_BACKEND_LIBEVENT or POUCH_BACKEND_EPOLL
+    int epfd;					// epoll set of the sockets and timerfd (epoll backend)
+    int timerfd;				// ... fires when libcurl's timeout expires
+    int timer_armed;			// ... timerfd is set
+    int loop_break;				// ... pmi_loop() should return
+    pmi_batch_cb batch_cb;		// USER DEFINED callback for all requests finished in a round
+    PouchReq **batch;			// ... requests finished in the current round
+    int batch_count;			// ... number of requests in batch
+    int batch_size;				// ... number of requests batch has room for
+    int max_inflight;			// most requests started at once, 0 for no limit
+    int max_host_inflight;		// ... to any one host, 0 for no limit
+    int max_pending;			// most requests pmi_submit lets wait, 0 for no limit
+    int inflight;				// requests started and not finished
+    PouchHost *hosts;			// ... of them per host
+    int host_count;				// ... number of hosts
+    int host_size;				// ... number of hosts there is room for
+    PouchReq *pending;			// requests waiting for a slot, oldest first,
+    PouchReq *pending_tail;		// ... linked through pr->next
+    int pending_count;			// ... number of requests waiting
+    PouchReq *session_login;	// POST /_session running to renew the session cookie,
+    PouchReq *session_waiting;	// ... requests held until it finishes,
+    PouchReq *session_waiting_tail;	// ... linked through pr->next
 };
 
+/** Start a request on the multi interface of a PouchMInfo.
+ *
+ *  The easy handle comes from pmi's pool of reusable handles (one is only
+ *  created when the pool is empty), and check_multi_info() returns it to the
+ *  pool when the request finishes, before the pr_proc_cb is called. A steady
+ *  multi workload therefore does not create or destroy any curl handles.
+ *
+ *  It may be called from inside a sink or other libcurl callback; the
+ *  request is then started as soon as the event loop regains control.
+ *
+ *  A request that needs a new session cookie (see session_pouch.h) waits
+ *  while pmi logs in with a request of its own, so the event loop is never
+ *  blocked by the login.
+ *
+ *  If pmi_set_limits() leaves no slot for it, the request waits in pmi's
+ *  queue however long that is; use pmi_submit() to be told when the queue
+ *  is full instead.
+ */
+PouchReq *pr_dopmi(PouchReq *pr, PouchMInfo *pmi);
+
+/** Start a request like pr_dopmi(), but refuse it when pmi's queue of
+ *  waiting requests is full.
+ *
+ *  Returns POUCH_STARTED, POUCH_QUEUED if it waits for a slot (a request
+ *  that is already waiting keeps its place), or POUCH_QUEUE_FULL, in which
+ *  case pr is left to the caller, untouched. A producer that gets
+ *  POUCH_QUEUE_FULL should hold back and submit again from a pr_proc_cb,
+ *  once requests have finished.
+ */
+int pmi_submit(PouchReq *pr, PouchMInfo *pmi);
+
+/** Limit how many requests pmi runs at once.
+ *
+ *  At most max_inflight requests are started at a time, and at most
+ *  max_host_inflight to the same scheme, host and port; the rest wait in a
+ *  queue, in order, and are started from check_multi_info() as requests
+ *  finish. max_pending caps that queue for pmi_submit(). 0 means no limit
+ *  for any of them, which is the default. Lowering a limit does not stop
+ *  requests already running.
+ */
+void pmi_set_limits(PouchMInfo *pmi, int max_inflight, int max_host_inflight, int max_pending);
+
+/** Give a single request its own pr_proc_cb, called when it finishes
+ *  instead of the PouchMInfo's. custom is stored in pr->custom.
+ */
+PouchReq *pr_set_done(PouchReq *pr, pr_proc_cb done, void *custom);
+
+/** Stop a request started with pr_dopmi before it finishes, or take it out
+ *  of the queue if it is still waiting for a slot. Its easy handle goes back
+ *  to pmi's pool and no pr_proc_cb is called; pr itself is left to the
+ *  caller to reuse or pr_free().
+ */
+void pr_cancel(PouchReq *pr, PouchMInfo *pmi);
+
 // libevent/libcurl multi interface helpers and callbacks
 void debug_mcode(const char *desc, CURLMcode code);
+/** Handle the requests that have finished: store their curlcode and
+ *  httpresponse, return their easy handles to the pool and pass them to
+ *  their own pr_proc_cb, the PouchMInfo's pmi_batch_cb or pr_proc_cb, or
+ *  pr_free() them if there isn't one.
+ */
 void check_multi_info(PouchMInfo *pmi /*, function pointer process_func*/);
 
 /** Update the event timer after curl_multi library calls */
@@ -119,12 +225,83 @@ int sock_cb(CURL *e, curl_socket_t s, int action, void *cbp, void *sockp);
  */
 PouchMInfo *pr_mk_pmi(struct event_base *base, struct evdns_base *dns_base, pr_proc_cb callback, void *custom);
 
+/** Initialize a PouchMInfo that runs on its own epoll set instead of libevent.
+ *
+ *  Sockets are registered with epoll_ctl() straight from the socket
+ *  callback, with no per-socket allocation, and libcurl's timeout is a
+ *  timerfd in the same set. Registrations are level-triggered: libcurl does
+ *  not promise to read or write a socket until it would block (a paused or
+ *  rate limited transfer leaves data waiting), and with edge-triggered
+ *  events such a socket would never be reported again.
+ *
+ *  Drive it with pmi_loop(). Helpers that schedule their own libevent
+ *  timers (PouchChanges retries, PouchBulk flush intervals) need the
+ *  libevent backend. Returns NULL if epoll or the timerfd can't be created.
+ */
+PouchMInfo *pr_mk_pmi_epoll(pr_proc_cb callback, void *custom);
+
+/** Run an epoll PouchMInfo until all of its requests, including any started
+ *  by pr_proc_cbs along the way, have finished or pmi_loopbreak() is
+ *  called. Returns 0, or -1 if pmi does not use the epoll backend or
+ *  epoll_wait() fails.
+ */
+int pmi_loop(PouchMInfo *pmi);
+
+/** Make pmi_loop() return once it has handled the current events; safe to
+ *  call from a pr_proc_cb. Requests still running are left as they are.
+ */
+void pmi_loopbreak(PouchMInfo *pmi);
+
+/** Return a file descriptor that becomes readable whenever an epoll
+ *  PouchMInfo has work to do, for a foreign event loop (GLib, a custom
+ *  reactor, ...) to watch instead of calling pmi_loop(). It is the epoll set
+ *  itself, so it also fires when libcurl's timeout expires. Returns -1 for
+ *  the libevent backend, whose sockets are already in the caller's loop.
+ */
+int pmi_fd(PouchMInfo *pmi);
+
+/** Return the longest time, in milliseconds, the caller may wait for
+ *  pmi_fd() before calling pmi_process() anyway; 0 means call it now and -1
+ *  that there is no deadline. Loops that only watch the fd may ignore it
+ *  except for 0, which requests started from inside libcurl callbacks ask
+ *  for.
+ */
+long pmi_timeout(PouchMInfo *pmi);
+
+/** Handle whatever is ready on an epoll PouchMInfo without blocking: socket
+ *  events, an expired timeout, requests waiting to be started, and then the
+ *  requests that finished. Returns 1 while requests remain, 0 once none do,
+ *  or -1 on error.
+ */
+int pmi_process(PouchMInfo *pmi);
+
+/** Deliver finished requests in batches. check_multi_info() collects the
+ *  requests that have no pr_proc_cb of their own and passes them to cb
+ *  together once it has read all of libcurl's messages; with the epoll
+ *  backend that is once per pmi_process() or pmi_loop() round. cb takes
+ *  precedence over the PouchMInfo's pr_proc_cb; pass NULL to go back to it.
+ */
+void pmi_set_batch_cb(PouchMInfo *pmi, pmi_batch_cb cb);
+
+/** Turn on HTTP/2 multiplexing for the requests started with pr_dopmi.
+ *
+ *  mode is POUCH_HTTP2 (negotiated with ALPN on https:// URLs) or
+ *  POUCH_HTTP2_PRIOR_KNOWLEDGE (for servers that speak cleartext h2), or
+ *  POUCH_HTTP1 to turn multiplexing back off. Requests wait for a stream on
+ *  an existing connection instead of opening a new one, so many concurrent
+ *  requests share a few sockets. The caps limit the number of connections
+ *  per host, the number of concurrent streams per connection and the total
+ *  number of connections kept open. A cap of 0 leaves libcurl's default.
+ */
+void pmi_set_http2(PouchMInfo *pmi, int mode, long max_host_conns, long max_streams, long max_conns);
+
 void pmi_multi_cleanup(PouchMInfo *pmi);
 
 /** Cleans up and deletes a PouchMInfo struct.
  * 
  *  It gets rid of the timer event, frees the event base (don't do this
- *  manually after calling pr_del_pmi!) and cleans up the CURLM handle.
+ *  manually after calling pr_del_pmi!) or closes the epoll set and timerfd,
+ *  and cleans up the CURLM handle.
  *  Afterwards, it frees the object. Don't try to free it again.
  */
 void pr_del_pmi(PouchMInfo *pmi);
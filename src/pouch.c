@@ -3,14 +3,155 @@
 #include <ctype.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <stdio.h>
 #include <fcntl.h>
+#include <unistd.h>
 #include <time.h>
+#include <pthread.h>
 
 // Libcurl
 #include <curl/curl.h>
+#include <zlib.h>
 
 #include "pouch.h"
+#include "rev_pouch.h"
+#include "etag_pouch.h"
+#include "mime_pouch.h"
+#include "session_pouch.h"
+
+// Process-wide setup
+static pthread_once_t global_once = PTHREAD_ONCE_INIT;
+static CURLcode global_code = CURLE_OK;
+
+static void global_init(void){
+    global_code = curl_global_init(CURL_GLOBAL_ALL);
+}
+int pouch_global_init(void){
+    pthread_once(&global_once, global_init);
+    return global_code == CURLE_OK ? 0 : -1;
+}
+
+// Process-wide shared cache
+static CURLSH *pouch_share = NULL;
+static pthread_mutex_t pouch_share_locks[CURL_LOCK_DATA_LAST];
+
+static void share_lock(CURL *curl, curl_lock_data data, curl_lock_access access, void *userp){
+    pthread_mutex_lock(&pouch_share_locks[data]);
+}
+static void share_unlock(CURL *curl, curl_lock_data data, void *userp){
+    pthread_mutex_unlock(&pouch_share_locks[data]);
+}
+int pouch_share_init(void){
+    int i;
+    if (pouch_share){	// already set up
+        return 0;
+    }
+    if (pouch_global_init()){
+        return -1;
+    }
+    for (i = 0; i < CURL_LOCK_DATA_LAST; i++){
+        pthread_mutex_init(&pouch_share_locks[i], NULL);
+    }
+    CURLSH *share = curl_share_init();
+    if (!share){
+        return -1;
+    }
+    curl_share_setopt(share, CURLSHOPT_LOCKFUNC, share_lock);
+    curl_share_setopt(share, CURLSHOPT_UNLOCKFUNC, share_unlock);
+    curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+    curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+    curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+    pouch_share = share;
+    return 0;
+}
+void pouch_share_cleanup(void){
+    int i;
+    if (!pouch_share){
+        return;
+    }
+    if (curl_share_cleanup(pouch_share) != CURLSHE_OK){
+        fprintf(stderr, "pouch_share_cleanup: share is still in use\n");
+        return;
+    }
+    pouch_share = NULL;
+    for (i = 0; i < CURL_LOCK_DATA_LAST; i++){
+        pthread_mutex_destroy(&pouch_share_locks[i]);
+    }
+}
+
+// Compression
+static int accept_encoding = 1;	// ask for compressed responses
+static size_t gzip_threshold = 0;	// compress bodies this big, 0 for never
+
+void pouch_compression(int accept, size_t threshold){
+    accept_encoding = accept;
+    gzip_threshold = threshold;
+}
+
+// Response buffer pool
+#define POOL_BUFS 32					// number of spare buffers kept
+#define POOL_MAX_ALLOC (4*1024*1024)	// bigger buffers are freed, not kept
+#define RESP_MIN_ALLOC 1024				// smallest response buffer
+static struct {
+    char *data;
+    size_t alloc;
+} resp_pool[POOL_BUFS];
+static int resp_pool_count = 0;
+static pthread_mutex_t resp_pool_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// takes a spare buffer from the pool, if there is one
+static char *resp_pool_get(size_t *alloc){
+    char *data = NULL;
+    pthread_mutex_lock(&resp_pool_lock);
+    if (resp_pool_count > 0){
+        resp_pool_count--;
+        data = resp_pool[resp_pool_count].data;
+        *alloc = resp_pool[resp_pool_count].alloc;
+    }
+    pthread_mutex_unlock(&resp_pool_lock);
+    return data;
+}
+// gives a buffer back to the pool, or frees it if the pool is full
+static void resp_pool_put(char *data, size_t alloc){
+    if (!data){
+        return;
+    }
+    pthread_mutex_lock(&resp_pool_lock);
+    if (resp_pool_count < POOL_BUFS && alloc <= POOL_MAX_ALLOC){
+        resp_pool[resp_pool_count].data = data;
+        resp_pool[resp_pool_count].alloc = alloc;
+        resp_pool_count++;
+        data = NULL;
+    }
+    pthread_mutex_unlock(&resp_pool_lock);
+    free(data);
+}
+// makes room for at least need more bytes (plus a '\0') in pr->resp,
+// growing the buffer geometrically. Returns 0 on success.
+static int resp_reserve(PouchReq *pr, size_t need){
+    size_t want = pr->resp.size + need + 1;
+    if (want <= pr->resp.alloc){
+        return 0;
+    }
+    if (!pr->resp.data){
+        pr->resp.data = resp_pool_get(&pr->resp.alloc);
+        if (pr->resp.data && want <= pr->resp.alloc){
+            return 0;
+        }
+    }
+    size_t alloc = pr->resp.alloc ? pr->resp.alloc : RESP_MIN_ALLOC;
+    while (alloc < want){
+        alloc *= 2;
+    }
+    char *data = (char *)realloc(pr->resp.data, alloc);
+    if (!data){
+        return -1;
+    }
+    pr->resp.data = pr->resp.offset = data;
+    pr->resp.alloc = alloc;
+    return 0;
+}
 
 // Miscellaneous helper functions
 char *url_escape(CURL *curl, char *str){
@@ -39,31 +180,36 @@ char *combine(char **out, char *f, char *s, char *sep){
 }
 
 char *doc_get_cur_rev(PouchReq * pr, char *server, char *db, char *id){
-    pr = doc_get_info(pr, server, db, id);
-    pr_do(pr);
-    // at this point, pr->resp.data has all of the header stuff.
-    char *etag_begin = strchr(pr->resp.data, '\"');
-    char *etag_end = strrchr(pr->resp.data, '\"');
-
-    size_t length = (size_t) (etag_end - etag_begin) - 1;
-
-    char *buf = (char *)malloc(length + 1);
-    memset(buf, 0, length + 1);
-    strncpy(buf, etag_begin + 1, length);
+    char *url = NULL;
+    url = combine(&url, server, db, "/");
+    url = combine(&url, url, id, "/");
+    char *buf = rev_cache_get(url);	// written or read recently?
 
-    if (pr->resp.data){
-        free(pr->resp.data);
+    if (!buf){
+        pr = doc_get_info(pr, server, db, id);
+        pr_do(pr);
+        // the revision is the ETag, in quotes
+        char *etag = pr->hdrs.etag;
+        size_t length = etag ? strlen(etag) : 0;
+        if (pr->httpresponse != 200 || length < 2 || etag[0] != '"'){
+            free(url);
+            return NULL;	// no such document
+        }
+        buf = strndup(etag + 1, length - 2);
+        rev_cache_put(url, buf);
     }
-    pr->resp.data = (char *)malloc(length + 1);
-    memset(pr->resp.data, 0, length + 1);
-    strncpy(pr->resp.data, buf, length + 1);
+    free(url);
+
+    pr_set_resp(pr, buf, strlen(buf));
 
     return buf;
 }
 
 // PouchReq functions
 PouchReq *pr_init(void){
+    pouch_global_init();	// libcurl must be set up before the first handle
     PouchReq *pr = calloc(1, sizeof(PouchReq));
+    pr->hdrs.content_length = -1;
 
     // initializes the request buffer
     pr->req.offset = pr->req.data = NULL;
@@ -79,6 +225,16 @@ PouchReq *pr_add_header(PouchReq *pr, char *h){
     pr->headers = curl_slist_append(pr->headers, h);
     return pr;
 }
+int pr_has_header(PouchReq *pr, char *name){
+    struct curl_slist *h;
+    size_t length = strlen(name);
+    for (h = pr->headers; h; h = h->next){
+        if (!strncasecmp(h->data, name, length)){
+            return 1;
+        }
+    }
+    return 0;
+}
 PouchReq *pr_add_usrpwd(PouchReq *pr, char *usrpwd, size_t length){
     if (pr->usrpwd){
         free(pr->usrpwd);
@@ -131,114 +287,276 @@ PouchReq *pr_set_url(PouchReq *pr, char *url){
 
     return pr;
 }
+// frees a request's data, unless it was lent to pouch by the caller
+static void pkt_free_data(PouchPkt *pkt){
+    if (pkt->data && !pkt->borrowed){
+        free(pkt->data);
+    }
+    if (pkt->from_fd && !pkt->borrowed){
+        close(pkt->fd);
+    }
+    pkt->data = pkt->offset = NULL;
+    pkt->size = 0;
+    pkt->borrowed = 0;
+    pkt->from_fd = 0;
+    pkt->gzipped = 0;
+}
+// replaces a request's data with a gzip compressed copy, if that is
+// smaller. Returns 1 if it was compressed.
+static int pkt_gzip(PouchPkt *pkt){
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    if (deflateInit2(&zs, POUCH_GZIP_LEVEL, Z_DEFLATED, 15 + 16, 8,
+                Z_DEFAULT_STRATEGY) != Z_OK){	// 15 + 16: gzip wrapper
+        return 0;
+    }
+    size_t alloc = deflateBound(&zs, pkt->size);
+    char *gz = (char *)malloc(alloc);
+    if (!gz){
+        deflateEnd(&zs);
+        return 0;
+    }
+    zs.next_in = (Bytef *)pkt->data;
+    zs.avail_in = pkt->size;
+    zs.next_out = (Bytef *)gz;
+    zs.avail_out = alloc;
+    if (deflate(&zs, Z_FINISH) != Z_STREAM_END || zs.total_out >= pkt->size){
+        deflateEnd(&zs);
+        free(gz);
+        return 0;
+    }
+    size_t size = zs.total_out;
+    deflateEnd(&zs);
+    pkt_free_data(pkt);
+    pkt->data = pkt->offset = gz;
+    pkt->size = size;
+    pkt->gzipped = 1;
+    return 1;
+}
 PouchReq *pr_set_data(PouchReq *pr, char *str){
     size_t length = strlen(str);
-    if (pr->req.data){	// free older data
-        free(pr->req.data);
-    }
-    // TODO: use strdup?
+    pkt_free_data(&pr->req);	// free older data
     pr->req.data = (char *)malloc(length+1);	// allocate space, include '\0'
-    memset(pr->req.data, '\0', length+1);		// write nulls to the new space
-    memcpy(pr->req.data, str, length);	// copy over the data
+    memcpy(pr->req.data, str, length+1);	// copy over the data and the '\0'
 
-    // Because of the way CURL sends data,
-    // before sending the PouchPkt's
-    // offset must point to the same address
-    // in memory as the data pointer does.
     pr->req.offset = pr->req.data;
     pr->req.size = length; // do not send the last '\0' - JSON is not null terminated
     return pr;
 }
 PouchReq *pr_set_prdata(PouchReq *pr, char *str, size_t len){
-    if(pr->req.data){
-        free(pr->req.data);
-    }
+    pkt_free_data(&pr->req);
     pr->req.data = str;
     pr->req.offset = pr->req.data;
     pr->req.size = len;
     return pr;
 }
 PouchReq *pr_set_bdata(PouchReq *pr, void *dat, size_t length){
-    if (pr->req.data){
-        free(pr->req.data);
-    }
+    pkt_free_data(&pr->req);
     pr->req.data = (char *)malloc(length);
     memcpy(pr->req.data, dat, length);
     pr->req.offset = pr->req.data;
     pr->req.size = length;
     return pr;
 }
-PouchReq *pr_clear_data(PouchReq *pr){
-    if (pr->req.data){
-        free(pr->req.data);
-        pr->req.data = NULL;
+PouchReq *pr_set_refdata(PouchReq *pr, void *dat, size_t length){
+    pkt_free_data(&pr->req);
+    pr->req.data = (char *)dat;
+    pr->req.offset = pr->req.data;
+    pr->req.size = length;
+    pr->req.borrowed = 1;
+    return pr;
+}
+PouchReq *pr_set_fdata(PouchReq *pr, int fd, off_t offset, size_t length){
+    pkt_free_data(&pr->req);
+    pr->req.from_fd = 1;
+    pr->req.fd = fd;
+    pr->req.fd_start = pr->req.fd_pos = (curl_off_t)offset;
+    pr->req.size = length;
+    pr->req.borrowed = 1;
+    return pr;
+}
+PouchReq *pr_clear_resp(PouchReq *pr){
+    pr->resp.size = 0;
+    if (pr->resp.data){
+        pr->resp.data[0] = '\0';
     }
-    pr->req.size = 0;
     return pr;
 }
-PouchReq *pr_do(PouchReq * pr){
+// forgets the headers of an earlier response
+static void hdrs_reset(PouchHeaders *hdrs){
+    free(hdrs->etag);
+    free(hdrs->content_type);
+    free(hdrs->location);
+    free(hdrs->auth_session);
+    curl_slist_free_all(hdrs->couch);
+    memset(hdrs, 0, sizeof(PouchHeaders));
+    hdrs->content_length = -1;
+}
+const char *pr_couch_header(PouchReq *pr, const char *name){
+    struct curl_slist *h;
+    size_t length = strlen(name);
+    for (h = pr->hdrs.couch; h; h = h->next){
+        if (!strncasecmp(h->data, name, length) && h->data[length] == ':'){
+            return h->data + length + 2;
+        }
+    }
+    return NULL;
+}
+PouchReq *pr_set_resp(PouchReq *pr, const char *data, size_t len){
+    pr_clear_resp(pr);
+    if (!resp_reserve(pr, len)){
+        memcpy(pr->resp.data, data, len);
+        pr->resp.data[len] = '\0';
+        pr->resp.size = len;
+    }
+    return pr;
+}
+char *pr_take_resp(PouchReq *pr, size_t *size){
+    char *data = pr->resp.data;
+    if (size){
+        *size = pr->resp.size;
+    }
+    pr->resp.data = pr->resp.offset = NULL;
+    pr->resp.size = pr->resp.alloc = 0;
+    return data;
+}
+PouchReq *pr_set_sink(PouchReq *pr, pr_sink_cb sink, void *userp){
+    pr->sink = sink;
+    pr->sink_data = userp;
+    return pr;
+}
+void pr_resume(PouchReq *pr){
+    if (pr->multi){	// running in the caller's event loop, unpause now
+        if (pr->paused){
+            pr->paused = 0;
+            curl_easy_pause(pr->easy, CURLPAUSE_CONT);
+        }
+    } else {	// inside pr_do(), possibly in another thread, possibly just
+                // before the sink's pause takes effect
+        __sync_lock_test_and_set(&pr->resume, 1);
+    }
+}
+PouchReq *pr_clear_data(PouchReq *pr){
+    pkt_free_data(&pr->req);
+    return pr;
+}
+void pr_setup_easy(PouchReq *pr, CURL *curl){
+    pr->paused = pr->resume = 0;
+    curl_easy_setopt(curl, CURLOPT_USERAGENT, "pouch/0.1");	// add user-agent
+    curl_easy_setopt(curl, CURLOPT_URL, pr->url);	// where to send this request
+    curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1); // TODO: why? multithreading?
+    curl_easy_setopt(curl, CURLOPT_TCP_KEEPALIVE, 1L);	// keep idle connections open
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, recv_data_callback);	// where to store the response
+    curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, recv_header_callback);	// where to store its headers
+    curl_easy_setopt(curl, CURLOPT_HEADERDATA, (void *)pr);
+    hdrs_reset(&pr->hdrs);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)pr);
+    if (pouch_share){	// use the process-wide DNS/connection/TLS cache
+        curl_easy_setopt(curl, CURLOPT_SHARE, pouch_share);
+    }
+    if (accept_encoding){	// inflate compressed responses as they arrive
+        curl_easy_setopt(curl, CURLOPT_ACCEPT_ENCODING, "");
+    }
+    if (pr->usrpwd){	// if there's a valid auth string, use it
+        curl_easy_setopt(curl, CURLOPT_USERPWD, pr->usrpwd);
+    }
+
+    // only PUTs and POSTs send data; other methods ignore leftover data from
+    // an earlier use of the request, which would otherwise turn a GET on a
+    // reused PouchReq into one with the old body
+    if (!strncmp(pr->method, PUT, 3) || !strncmp(pr->method, POST, 4)){
+        if (pr->req.from_fd){	// stream the data from a file
+            pr->req.fd_pos = pr->req.fd_start;
+            curl_easy_setopt(curl, CURLOPT_UPLOAD, 1L);
+            curl_easy_setopt(curl, CURLOPT_READFUNCTION, send_fd_callback);
+            curl_easy_setopt(curl, CURLOPT_READDATA, (void *)pr);
+            curl_easy_setopt(curl, CURLOPT_SEEKFUNCTION, seek_fd_callback);
+            curl_easy_setopt(curl, CURLOPT_SEEKDATA, (void *)pr);
+            curl_easy_setopt(curl, CURLOPT_INFILESIZE_LARGE,
+                    (curl_off_t)pr->req.size);
+        } else if (pr->req.data && pr->req.size > 0){	// check for data upload
+            int json = !pr_has_header(pr, "Content-Type:") ||
+                pr_has_header(pr, "Content-Type: application/json");
+            if (!pr->req.gzipped && json && gzip_threshold &&
+                    pr->req.size >= gzip_threshold &&
+                    !pr_has_header(pr, "Content-Encoding:")){
+                pkt_gzip(&pr->req);
+            }
+            if (pr->req.gzipped){
+                pr_add_header(pr, "Content-Encoding: gzip");
+            }
+            //printf("--> %s\n", pr->req.data);
+            // libcurl sends the buffer straight from pr->req.data, with a
+            // Content-Length, so it is never copied on our side
+            curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE_LARGE,
+                    (curl_off_t)pr->req.size);
+            curl_easy_setopt(curl, CURLOPT_POSTFIELDS, pr->req.data);
+        } else {	// nothing to send, but still send an empty body
+            curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, 0L);
+            curl_easy_setopt(curl, CURLOPT_POSTFIELDS, "");
+        }
+        if (!pr_has_header(pr, "Content-Type:")){	// JSON unless told otherwise
+            pr_add_header(pr, "Content-Type: application/json");
+        }
+        pr_add_header(pr, "Expect:");	// don't wait for 100-continue
+    }
+
+    if (!strncmp(pr->method, HEAD, 4)){	// HEAD-specific options
+        curl_easy_setopt(curl, CURLOPT_NOBODY, 1);	// the headers are in pr->hdrs
+    } else {
+        curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST,
+                pr->method);
+    }		// THIS FIXED HEAD REQUESTS
+
+    etag_cache_prepare(pr);	// If-None-Match, if the response is cached
+    session_prepare(pr, curl);	// the session cookie, if logged in
+
+    // add the custom headers
+    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, pr->headers);
+}
+// gets pr's easy handle (reusing the old one, so its connection stays open)
+// ready for a new transfer. Returns NULL if there is no handle.
+static CURL *pr_prepare(PouchReq *pr){
     CURL *curl;		// CURL object to make the requests
-    //pr->headers= NULL;    // Custom headers for uploading
 
     // empty the response buffer
-    if (pr->resp.data){
-        free(pr->resp.data);
-    }
-    pr->resp.data = NULL;
-    pr->resp.size = 0;
+    pr_clear_resp(pr);
 
-    // initialize the CURL object
-    curl = curl_easy_init();
+    // reuse the request's CURL object if it has one. libcurl keeps its
+    // connection cache on the easy handle, so reusing it keeps the connection
+    // (and any TLS session) to the server alive between calls.
+    if (pr->easy && pr->multi){	// last used by pr_domulti
+        curl_multi_remove_handle(pr->multi, pr->easy);
+        pr->multi = NULL;
+    }
+    if (pr->easy){
+        curl_easy_reset(pr->easy);	// forget old options, keep connections
+    } else {
+        pr->easy = curl_easy_init();
+    }
+    curl = pr->easy;
     if (curl){
         // Print the request
         //printf("%s : %s\n", pr->method, pr->url);
 
         // setup the CURL object/request
-        curl_easy_setopt(curl, CURLOPT_USERAGENT, "pouch/0.1");	// add user-agent
-        curl_easy_setopt(curl, CURLOPT_URL, pr->url);	// where to send this request
+        pr_setup_easy(pr, curl);
         curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, 2);	// maximum amount of time to create connection
         curl_easy_setopt(curl, CURLOPT_TIMEOUT, 60);	// maximum amount of time to send data = 1 minute
-        curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1); // TODO: why? multithreading?
-        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, recv_data_callback);	// where to store the response
-        curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)pr);
-        if (pr->usrpwd){	// if there's a valid auth string, use it
-            curl_easy_setopt(curl, CURLOPT_USERPWD, pr->usrpwd);
-        }
-
-        if (pr->req.data && pr->req.size > 0){	// check for data upload
-            //printf("--> %s\n", pr->req.data);
-            // let CURL know what data to send
-            curl_easy_setopt(curl, CURLOPT_READFUNCTION,
-                    send_data_callback);
-            curl_easy_setopt(curl, CURLOPT_READDATA, (void *)pr);
+        if (pr->sink){	// streams can be long: no time limit, and watch for pr_resume()
+            curl_easy_setopt(curl, CURLOPT_TIMEOUT, 0L);
+            curl_easy_setopt(curl, CURLOPT_XFERINFOFUNCTION, resume_progress_callback);
+            curl_easy_setopt(curl, CURLOPT_XFERINFODATA, (void *)pr);
+            curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 0L);
         }
-
-        if (!strncmp(pr->method, PUT, 3)){	// PUT-specific option
-            curl_easy_setopt(curl, CURLOPT_UPLOAD, 1);
-            // Note: Content-Type: application/json is automatically assumed
-        } else if (!strncmp(pr->method, POST, 4)){	// POST-specific options
-            curl_easy_setopt(curl, CURLOPT_POST, 1);
-            pr_add_header(pr, "Content-Type: application/json");
-        }
-
-        if (!strncmp(pr->method, HEAD, 4)){	// HEAD-specific options
-            curl_easy_setopt(curl, CURLOPT_NOBODY, 1);
-            curl_easy_setopt(curl, CURLOPT_HEADER, 1);
-        } else {
-            curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST,
-                    pr->method);
-        }		// THIS FIXED HEAD REQUESTS
-
-        // add the custom headers
-        pr_add_header(pr, "Transfer-Encoding: chunked");
-        curl_easy_setopt(curl, CURLOPT_HTTPHEADER, pr->headers);
-
-        // make the request and store the response
-        pr->curlcode = curl_easy_perform(curl);
     } else {
         // if we were unable to initialize a CURL object
-        pr->curlcode = 2;
+        pr->curlcode = CURLE_FAILED_INIT;
     }
+    return curl;
+}
+// stores the outcome of a finished transfer in pr
+static void pr_finish(PouchReq *pr){
     // clean up
     if (pr->headers){
         curl_slist_free_all(pr->headers);	// free headers
@@ -246,12 +564,28 @@ PouchReq *pr_do(PouchReq * pr){
     }
     if (!pr->curlcode){
         pr->curlcode =
-            curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE,
+            curl_easy_getinfo(pr->easy, CURLINFO_RESPONSE_CODE,
                     &pr->httpresponse);
         if (pr->curlcode != CURLE_OK)
             pr->httpresponse = 500;
+        else {
+            rev_cache_update(pr);	// remember the revision a write returned
+            etag_cache_finish(pr);	// keep the body, or answer a 304 from it
+            session_finish(pr);	// keep a renewed session cookie
+        }
     }
-    curl_easy_cleanup(curl);	// clean up the curl object
+    // the CURL object is kept on pr for the next call; pr_free() cleans it up
+}
+PouchReq *pr_do(PouchReq * pr){
+    CURL *curl = pr_prepare(pr);
+    if (curl){
+        // make the request and store the response
+        pr->curlcode = curl_easy_perform(curl);
+        if (pr->curlcode == CURLE_OK && session_retry(pr)){	// the session had expired
+            pr->curlcode = curl_easy_perform(curl);
+        }
+    }
+    pr_finish(pr);
 
     // Print the response
     //printf("Received %d bytes, status = %d\n",
@@ -259,21 +593,91 @@ PouchReq *pr_do(PouchReq * pr){
     //printf("--> %s\n", pr->resp.data);
     return pr;
 }
+int pr_do_batch(PouchReq **reqs, size_t n, int max_concurrency){
+    size_t next = 0, running = 0;
+    int still_running = 0;
+    CURLMsg *msg;
+    int msgs_left;
+    CURLM *multi;
+
+    pouch_global_init();
+    multi = curl_multi_init();
+    if (!multi){
+        return -1;
+    }
+    if (max_concurrency <= 0){
+        max_concurrency = n;
+    }
+    while (next < n || running > 0){
+        // keep up to max_concurrency transfers going
+        while (next < n && running < (size_t)max_concurrency){
+            PouchReq *pr = reqs[next++];
+            CURL *curl = pr_prepare(pr);
+            if (!curl){
+                pr_finish(pr);
+                continue;
+            }
+            curl_easy_setopt(curl, CURLOPT_PRIVATE, (void *)pr);
+            pr->curlmcode = curl_multi_add_handle(multi, curl);
+            if (pr->curlmcode != CURLM_OK){
+                pr->curlcode = CURLE_FAILED_INIT;
+                pr_finish(pr);
+                continue;
+            }
+            pr->multi = multi;
+            running++;
+        }
+        if (curl_multi_perform(multi, &still_running) != CURLM_OK){
+            break;
+        }
+        while ((msg = curl_multi_info_read(multi, &msgs_left))){
+            PouchReq *pr;
+            if (msg->msg != CURLMSG_DONE){
+                continue;
+            }
+            curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, &pr);
+            pr->curlcode = msg->data.result;
+            curl_multi_remove_handle(multi, msg->easy_handle);
+            if (pr->curlcode == CURLE_OK && session_retry(pr)){	// the session had expired
+                curl_multi_add_handle(multi, msg->easy_handle);
+                continue;
+            }
+            pr->multi = NULL;
+            pr_finish(pr);
+            running--;
+        }
+        if (running > 0){	// sleep until there is something to do
+            curl_multi_poll(multi, NULL, 0, 1000, NULL);
+        }
+    }
+    if (running > 0){	// the multi handle failed: give up on the rest
+        size_t i;
+        for (i = 0; i < next; i++){
+            if (reqs[i]->multi == multi){
+                curl_multi_remove_handle(multi, reqs[i]->easy);
+                reqs[i]->multi = NULL;
+                reqs[i]->curlcode = CURLE_FAILED_INIT;
+                pr_finish(reqs[i]);
+            }
+        }
+    }
+    curl_multi_cleanup(multi);	// the easy handles stay on their requests
+    return running > 0 ? -1 : 0;
+}
 void pr_free(PouchReq *pr){
     if (pr->easy){	// free request and remove it from multi
-        int ret;
         if (pr->multi){
-            ret = curl_multi_remove_handle(pr->multi, pr->easy);
-            printf("(%d) remd easy %p from multi %p\n", ret, pr->easy, pr->multi);
+            curl_multi_remove_handle(pr->multi, pr->easy);
         }
         curl_easy_cleanup(pr->easy);
-        printf("(?) clnd easy %p\n", pr->easy);
     }
-    if (pr->resp.data){			// free response data
-        free(pr->resp.data);
-    }if (pr->req.data){
-        free(pr->req.data);		// free request data
-    }if (pr->method){			// free method string
+    if (pr->resp.data){			// give the response buffer back to the pool
+        resp_pool_put(pr->resp.data, pr->resp.alloc);
+    }
+    pkt_free_data(&pr->req);	// free request data, or close its file
+    hdrs_reset(&pr->hdrs);
+    free(pr->etag_entry);		// a cached body no 304 came for
+    if (pr->method){			// free method string
         free(pr->method);
     }if (pr->url){				// free URL string
         free(pr->url);
@@ -434,108 +838,87 @@ PouchReq *doc_copy(PouchReq * pr, char *server, char *db, char *id,char *newid,
     return pr;
 }
 PouchReq *doc_delete(PouchReq * pr, char *server, char *db, char *id,char *rev){
+    char *cur = NULL;
+    if (!rev){	// from the revision cache, or else a HEAD request
+        rev = cur = doc_get_cur_rev(pr, server, db, id);
+        if (!rev){
+            rev = "";	// the server will answer with an error
+        }
+    }
     pr_set_method(pr, DELETE);
     pr_set_url(pr, server);
     pr->url = combine(&(pr->url), pr->url, db, "/");
     pr->url = combine(&(pr->url), pr->url, id, "/");
     pr_add_param(pr, "rev", rev);
+    free(cur);
+    return pr;
+}
+PouchReq *doc_update(PouchReq *pr, char *server, char *db, char *id, char *data){
+    char *rev = doc_get_cur_rev(pr, server, db, id);
+    pr = doc_create_id(pr, server, db, id, data);
+    if (rev){
+        pr_add_param(pr, "rev", rev);
+        free(rev);
+    }
     return pr;
 }
 PouchReq *doc_add_attachment(PouchReq * pr, char *server, char *db,char *doc, char *filename){
-    // load the file into memory
+    return doc_add_attachment_rev(pr, server, db, doc, NULL, filename);
+}
+PouchReq *doc_add_attachment_fd(PouchReq *pr, char *server, char *db, char *doc, char *rev, char *name, int fd, size_t length, char *content_type){
+    char *ct = NULL;
+    pr_set_fdata(pr, fd, 0, length);
+    if (!content_type){
+        content_type = (char *)pouch_mime_type_fd(name, fd);
+    }
+    ct = combine(&ct, "Content-Type:", content_type, " ");
+    pr_add_header(pr, ct);
+    free(ct);
+    pr_set_method(pr, PUT);
+    pr_set_url(pr, server);
+    pr->url = combine(&(pr->url), pr->url, db, "/");
+    pr->url = combine(&(pr->url), pr->url, doc, "/");
+    pr->url = combine(&(pr->url), pr->url, name, "/");
+    if (rev){
+        pr_add_param(pr, "rev", rev);
+    }
+    return pr;
+}
+PouchReq *doc_add_attachment_rev(PouchReq * pr, char *server, char *db,char *doc, char *rev, char *filename){
+    // the file is streamed from disk when the request is made
     struct stat file_info;
     int fd = open(filename, O_RDONLY);
-    if (!fd){
+    if (fd < 0){
         fprintf(stderr,
                 "doc_upload_attachment: could not open file %s\n",
                 filename);
-    }
-    if (lstat(filename, &file_info) != 0){
-        fprintf(stderr,
-                "doc_upload_attachment: could not lstat file %s\n",
-                filename);
         return pr;
         // TODO: include an "error" integer in each PouchReq, to be set
         //               by different wrapper functions
     }
-    // read file into buffer
-    size_t fd_len = file_info.st_size;
-    char fd_buf[fd_len];
-    int numbytes = read(fd, fd_buf, fd_len);
-    pr_set_bdata(pr, (void *)fd_buf, fd_len);
-    close(fd);
-    // just in case the actual mime-type is weird or broken, add a default
-    // mime-type of application/octet-stream, which is used for binary files.
-    // this way, even if something goes horribly wrong, we'll be able to download
-    // and view the data we've uploaded.
-    pr = pr_add_header(pr, "Content-Type: application/octet-stream");
-    // get mime type
-    if (USE_SYS_FILE){
-        FILE *comres;
-        char combuf[strlen("file --mime-type ") + strlen(filename) + 1];
-        sprintf(combuf, "file --mime-type %s", filename);
-        comres = popen(combuf, "r");
-        char comdet[10000];
-        fgets(comdet, 10000, comres);
-        fclose(comres);
-        // store the mime type to a buffer
-        char *mtype;
-        if ((mtype = strchr(comdet, ' ')) == NULL){
-            fprintf(stderr, "could not get mimetype\n");
-        }
-        mtype++;
-        char *endmtype;
-        if ((endmtype = strchr(mtype, '\n')) == NULL){
-            fprintf(stderr, "could not get end of mimetype\n");
-        }
-        char ct[strlen("Content-Type: ") + (endmtype - mtype) + 1];
-        snprintf(ct,
-                strlen("Content-Type: ") + (size_t) (endmtype -
-                    mtype) + 1,
-                "Content-Type: %s", mtype);
-        // add the actual mime-type
-        pr = pr_add_header(pr, ct);
-    } else {
-        char *dot;
-        if ((dot = strchr(filename, '.')) != NULL){	// if null, then binary file
-            char lowercase[strlen(dot) + 1];
-            strcpy(lowercase, dot);
-            int i;
-            for (i = 0; i < strlen(dot); i++){
-                lowercase[i] = tolower(lowercase[i]);
-            }
-            if (!strcmp(lowercase, ".jpg")
-                    || !strcmp(lowercase, ".jpeg")){
-                pr_add_header(pr, "Content-Type: image/jpeg");
-            } else if (!strcmp(lowercase, ".png")){
-                pr_add_header(pr, "Content-Type: image/png");
-            } else if (!strcmp(lowercase, ".gif")){
-                pr_add_header(pr, "Content-Type: image/gif");
-            } else if (!strcmp(lowercase, ".tif")){
-                pr_add_header(pr, "Content-Type: image/tiff");
-            } else if (!strcmp(lowercase, ".c")
-                    || !strcmp(lowercase, ".h")
-                    || !strcmp(lowercase, ".cpp")
-                    || !strcmp(lowercase, ".cxx")
-                    || !strcmp(lowercase, ".py")
-                    || !strcmp(lowercase, ".md")
-                    || !strcmp(lowercase, ".text")
-                    || !strcmp(lowercase, ".txt")){
-                pr_add_header(pr, "Content-Type: text/plain");
-            } else if (!strcmp(lowercase, ".pdf")){
-                pr_add_header(pr,
-                        "Content-Type: application/pdf");
-            }
-        }
+    if (fstat(fd, &file_info) != 0){
+        fprintf(stderr,
+                "doc_upload_attachment: could not stat file %s\n",
+                filename);
+        close(fd);
+        return pr;
     }
+    pr_set_fdata(pr, fd, 0, (size_t)file_info.st_size);
+    pr->req.borrowed = 0;	// pouch closes the file
+    // the type is found in-process, from the file's first bytes and name
+    char *ct = NULL;
+    ct = combine(&ct, "Content-Type:", (char *)pouch_mime_type_fd(filename, fd), " ");
+    pr_add_header(pr, ct);
+    free(ct);
     // finish setting request
     pr_set_method(pr, PUT);
     pr_set_url(pr, server);
     pr->url = combine(&(pr->url), pr->url, db, "/");
     pr->url = combine(&(pr->url), pr->url, doc, "/");
     pr->url = combine(&(pr->url), pr->url, filename, "/");
-    // TODO: add support for adding to existing documents by auto-fetching the rev parameter
-    //pr_add_param(pr, "rev", rev);
+    if (rev){
+        pr_add_param(pr, "rev", rev);
+    }
     return pr;
 }
 
@@ -543,17 +926,94 @@ PouchReq *doc_add_attachment(PouchReq * pr, char *server, char *db,char *doc, ch
 size_t recv_data_callback(char *ptr, size_t size, size_t nmemb, void *data){
     size_t ptrsize = nmemb*size; // this is the size of the data pointed to by ptr
     PouchReq *pr = (PouchReq *)data;
-    pr->resp.data = (char *)realloc(pr->resp.data, pr->resp.size + ptrsize +1);
-    if (pr->resp.data){	// realloc was successful
+    if (pr->sink){	// stream the data out instead of keeping it
+        size_t ret = pr->sink(pr, ptr, ptrsize, pr->sink_data);
+        if (ret == POUCH_SINK_PAUSE){
+            pr->paused = 1;
+        }
+        return ret;
+    }
+    if (!resp_reserve(pr, ptrsize)){	// buffer is big enough
         memcpy(&(pr->resp.data[pr->resp.size]), ptr, ptrsize); // append new data
         pr->resp.size += ptrsize;
         pr->resp.data[pr->resp.size] = '\0'; // null terminate the new data
     }
     else { // realloc was NOT successful
         fprintf(stderr, "recv_data_callback: realloc failed\n");
+        return 0;
     }
     return ptrsize; // theoretically, this is the amount of processed data
 }
+int resume_progress_callback(void *data, curl_off_t dltotal, curl_off_t dlnow, curl_off_t ultotal, curl_off_t ulnow){
+    PouchReq *pr = (PouchReq *)data;
+    if (pr->paused && __sync_lock_test_and_set(&pr->resume, 0)){
+        pr->paused = 0;
+        curl_easy_pause(pr->easy, CURLPAUSE_CONT);
+    }
+    return 0;
+}
+// copies a header value, without surrounding whitespace, into a new string
+static char *header_dup(const char *val, size_t len){
+    while (len && isspace((unsigned char)*val)){
+        val++;
+        len--;
+    }
+    while (len && isspace((unsigned char)val[len - 1])){
+        len--;
+    }
+    return strndup(val, len);
+}
+size_t recv_header_callback(char *buf, size_t size, size_t nitems, void *data){
+    size_t length = size*nitems;
+    PouchReq *pr = (PouchReq *)data;
+    PouchHeaders *hdrs = &pr->hdrs;
+    char *colon = memchr(buf, ':', length);
+
+    if (length > 5 && !strncmp(buf, "HTTP/", 5)){	// a new response begins
+        hdrs_reset(hdrs);
+        char *code = memchr(buf, ' ', length);
+        hdrs->status = code ? strtol(code, NULL, 10) : 0;
+    } else if (length <= 2){	// the end of the headers: make room for the body
+        if (!pr->sink && hdrs->content_length > 0 && hdrs->status >= 200 &&
+                hdrs->status != 204 && hdrs->status != 304 &&
+                strcmp(pr->method, HEAD)){
+            resp_reserve(pr, (size_t)hdrs->content_length);
+        }
+    } else if (colon){
+        size_t name_len = colon - buf;
+        char *val = colon + 1;
+        size_t val_len = length - name_len - 1;
+        if (name_len == 14 && !strncasecmp(buf, "Content-Length", 14)){
+            hdrs->content_length = (curl_off_t)strtoll(val, NULL, 10);
+        } else if (name_len == 4 && !strncasecmp(buf, "ETag", 4)){
+            free(hdrs->etag);
+            hdrs->etag = header_dup(val, val_len);
+        } else if (name_len == 12 && !strncasecmp(buf, "Content-Type", 12)){
+            free(hdrs->content_type);
+            hdrs->content_type = header_dup(val, val_len);
+        } else if (name_len == 8 && !strncasecmp(buf, "Location", 8)){
+            free(hdrs->location);
+            hdrs->location = header_dup(val, val_len);
+        } else if (name_len == 10 && !strncasecmp(buf, "Set-Cookie", 10)){
+            char *cookie = header_dup(val, val_len);
+            if (cookie && !strncmp(cookie, "AuthSession=", 12)){
+                cookie[strcspn(cookie, ";")] = '\0';
+                free(hdrs->auth_session);
+                hdrs->auth_session = cookie;
+            } else {
+                free(cookie);
+            }
+        } else if (name_len > 8 && !strncasecmp(buf, "X-Couch-", 8)){
+            char *value = header_dup(val, val_len);
+            char *line = (char *)malloc(name_len + strlen(value) + 3);
+            sprintf(line, "%.*s: %s", (int)name_len, buf, value);
+            hdrs->couch = curl_slist_append(hdrs->couch, line);
+            free(line);
+            free(value);
+        }
+    }
+    return length;
+}
 size_t send_data_callback(void *ptr, size_t size, size_t nmemb, void *data){
     size_t maxcopysize = nmemb*size;
     if (maxcopysize < 1){
@@ -569,3 +1029,29 @@ size_t send_data_callback(void *ptr, size_t size, size_t nmemb, void *data){
     }
     return 0;
 }
+size_t send_fd_callback(char *ptr, size_t size, size_t nmemb, void *data){
+    PouchReq *pr = (PouchReq *)data;
+    curl_off_t left = pr->req.fd_start + (curl_off_t)pr->req.size - pr->req.fd_pos;
+    size_t tocopy = nmemb*size;
+    if (left <= 0){
+        return 0;
+    }
+    if ((curl_off_t)tocopy > left){
+        tocopy = (size_t)left;
+    }
+    ssize_t got = pread(pr->req.fd, ptr, tocopy, (off_t)pr->req.fd_pos);
+    if (got <= 0){	// error, or the file shrank under us
+        fprintf(stderr, "send_fd_callback: could not read file\n");
+        return CURL_READFUNC_ABORT;
+    }
+    pr->req.fd_pos += got;
+    return (size_t)got;
+}
+int seek_fd_callback(void *data, curl_off_t offset, int origin){
+    PouchReq *pr = (PouchReq *)data;
+    if (origin != SEEK_SET || offset < 0 || offset > (curl_off_t)pr->req.size){
+        return CURL_SEEKFUNC_CANTSEEK;
+    }
+    pr->req.fd_pos = pr->req.fd_start + offset;
+    return CURL_SEEKFUNC_OK;
+}
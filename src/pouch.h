@@ -14,7 +14,6 @@
 #include <curl/curl.h>
 
 // Defines
-#define USE_SYS_FILE 0
 #define GET "GET"
 #define PUT "PUT"
 #define POST "POST"
@@ -24,7 +23,30 @@
 
 // Structs
 typedef struct _PouchPkt PouchPkt;
+typedef struct _PouchHeaders PouchHeaders;
 typedef struct _PouchReq PouchReq;
+typedef struct _PouchMInfo PouchMInfo;
+
+/** pr_proc_cb
+ *
+ *  Callback function for processing finished PouchReqs
+ *
+ *  If a pr_proc_cb is set by the user, that function becomes responsible for
+ *  pr_free()'ing the received PouchReq.
+ */
+typedef void (*pr_proc_cb)(PouchReq *, PouchMInfo *);
+
+/** pr_sink_cb
+ *
+ *  Callback that receives a response's data as it arrives, instead of it
+ *  being collected in pr->resp. It must return len once it has consumed the
+ *  data, or POUCH_SINK_PAUSE to pause the transfer (the same data is passed
+ *  in again after pr_resume()). Any other value aborts the request.
+ */
+typedef size_t (*pr_sink_cb)(PouchReq *pr, char *data, size_t len, void *userp);
+#define POUCH_SINK_PAUSE CURL_WRITEFUNC_PAUSE
+
+#define POUCH_GZIP_LEVEL 6	// zlib level request bodies are compressed at
 
 /** _PouchPkt
  *
@@ -34,6 +56,28 @@ struct _PouchPkt {
     char *data;
     char *offset;
     size_t size;
+    int borrowed;	// data (or fd) belongs to the caller and is never freed by pouch
+    size_t alloc;	// bytes allocated for data (responses only)
+    int from_fd;	// size bytes are read from fd instead of data (requests only)
+    int fd;			// ... file to read from
+    curl_off_t fd_start;	// ... offset of the first byte to send
+    curl_off_t fd_pos;	// ... offset of the next byte to send
+    int gzipped;	// data was gzip compressed by pouch (requests only)
+};
+
+/** _PouchHeaders
+ *
+ *  The response headers pouch keeps, parsed as they arrive. Strings are NULL
+ *  if the header was not sent, and belong to the request.
+ */
+struct _PouchHeaders {
+    long status;		// status code from the status line
+    curl_off_t content_length;	// Content-Length, or -1 if not sent
+    char *etag;			// ETag as sent, quotes included
+    char *content_type;	// Content-Type
+    char *location;		// Location
+    char *auth_session;	// "AuthSession=..." from a Set-Cookie header
+    struct curl_slist *couch;	// X-Couch-* headers, as "Name: value"
 };
 
 /** _PouchReq
@@ -42,7 +86,7 @@ struct _PouchPkt {
  *  response, as well as any error codes.
  */
 struct _PouchReq {
-    CURL *easy;			// CURL easy request
+    CURL *easy;			// CURL easy request, kept between pr_do() calls
     CURLcode curlcode;	// CURL easy interface error code
     CURLM *multi;		// CURL multi object
     CURLMcode curlmcode; // CURLM multi interface error code
@@ -52,10 +96,63 @@ struct _PouchReq {
     char *url;			// Destination (e.g., "http://127.0.0.1:5984/test");
     char *usrpwd;		// Holds a user:password authentication string
     long httpresponse;	// holds the http response of a request
+    PouchHeaders hdrs;	// parsed response headers
     PouchPkt req;		// holds data to be sent
     PouchPkt resp;		// holds response
+    pr_sink_cb sink;	// if set, receives the response instead of resp
+    void *sink_data;	// ... USER DEFINED pointer passed to the sink
+    int paused;			// the sink paused the transfer
+    int resume;			// pr_resume() was called while paused in pr_do()
+    pr_proc_cb done;	// if set, called instead of the PouchMInfo's callback
+    void *custom;		// ... USER DEFINED pointer to some data
+    PouchReq *next;		// used by a PouchMInfo to queue the request
+    int admitted;		// ... holds one of its in-flight slots
+    int queued;			// ... waits in its queue for a slot
+    char *etag_entry;	// copy of the cached ETag and body If-None-Match was sent for
+    size_t etag_entry_len;	// ... its length
+    int session;		// login the session cookie came from, -1 once resent
 };
 
+// Process-wide setup
+
+/** Set up libcurl (curl_global_init()) exactly once, however many threads
+ *  call it at the same time. pr_init() and pouch_share_init() call it, so
+ *  it only needs calling directly before using libcurl outside pouch.
+ *  Returns 0, or -1 if libcurl could not be set up.
+ */
+int pouch_global_init(void);
+
+// Process-wide shared cache
+
+/** Turn on the process-wide share layer.
+ *
+ *  After this is called, every request made with pr_do() or pr_domulti(), in
+ *  any thread, shares one DNS cache, connection cache and TLS session cache,
+ *  so a new thread's first request can reuse a warm connection instead of
+ *  doing a full handshake. Access is serialized with a mutex per type of
+ *  shared data. Call it once, before starting any requests. Returns 0 on
+ *  success and -1 if the share handle could not be created.
+ */
+int pouch_share_init(void);
+
+/** Turn off the share layer. Call it only after all requests, and all
+ *  PouchReqs that used the share layer, have been freed.
+ */
+void pouch_share_cleanup(void);
+
+// Compression
+
+/** Set up compression for all requests made from now on.
+ *
+ *  If accept is nonzero (the default), requests send Accept-Encoding with
+ *  every encoding libcurl supports, and compressed responses are inflated as
+ *  they arrive, before they reach pr->resp or a sink. JSON request bodies of
+ *  threshold bytes or more are sent gzip compressed, with Content-Encoding:
+ *  gzip; a threshold of 0 (the default) never compresses them. Bodies read
+ *  from a file and bodies that do not get smaller are sent as they are.
+ */
+void pouch_compression(int accept, size_t threshold);
+
 // Miscellaneous helper functions
 
 /** URL escapes a string. Use this to escape database names. */
@@ -72,7 +169,10 @@ char *combine(char **out, char *f, char *s, char *sep);
 /** Stores the current revision of the document in pr->resp.data.
  *
  * If you want to do anything with that revision string, make sure to copy it
- * to another place in memory before reusing the request.
+ * to another place in memory before reusing the request. When the revision
+ * cache is on (see rev_pouch.h) and holds the document, no request is made.
+ * Returns a copy of the revision that must be free()d, or NULL if the
+ * document doesn't exist.
  */
 char *doc_get_cur_rev(PouchReq *pr, char *server, char *db, char *id);
 
@@ -84,6 +184,11 @@ PouchReq *pr_init(void);
 /** Add a custom header to a request */
 PouchReq *pr_add_header(PouchReq *pr, char *h);
 
+/** Check whether a request already has a custom header that starts with
+ *  name (e.g. "Content-Type:"), ignoring case
+ */
+int pr_has_header(PouchReq *pr, char *name);
+
 PouchReq *pr_add_usrpwd(PouchReq *pr, char *usrpwd, size_t length);
 
 /** Add a parameter to a request's URL string, regardless of whether other
@@ -104,17 +209,103 @@ PouchReq *pr_set_url(PouchReq *pr, char *url);
  *  data, do not call this function. */
 PouchReq *pr_set_data(PouchReq *pr, char *str);
 
+/** Set the data that a request sends, taking ownership of str (which must
+ *  have been malloc()ed). No copy is made, and str is freed along with the
+ *  request.
+ */
 PouchReq *pr_set_prdata(PouchReq *pr, char *str, size_t len);
+
+/** Set the data that a request sends to a copy of length bytes of dat */
 PouchReq *pr_set_bdata(PouchReq *pr, void *dat, size_t length);
 
+/** Set the data that a request sends to a buffer that still belongs to the
+ *  caller. No copy is made and pouch never frees it, so the buffer must stay
+ *  valid and unchanged until the request has finished.
+ */
+PouchReq *pr_set_refdata(PouchReq *pr, void *dat, size_t length);
+
+/** Set the data that a request sends to length bytes of the file fd,
+ *  starting at offset. The file is read with pread() as the data goes out,
+ *  so memory use stays constant whatever its size, and Content-Length is
+ *  set up front. fd still belongs to the caller and must stay open until the
+ *  request has finished. (To send from an mmap()ed file instead, pass the
+ *  mapping to pr_set_refdata().)
+ */
+PouchReq *pr_set_fdata(PouchReq *pr, int fd, off_t offset, size_t length);
+
+/** Stream the response of a request to sink as it arrives.
+ *
+ *  The response is not collected in pr->resp, so memory use stays constant
+ *  however big the response is, and there is no overall time limit on the
+ *  request. Call with sink = NULL to collect responses in pr->resp again.
+ */
+PouchReq *pr_set_sink(PouchReq *pr, pr_sink_cb sink, void *userp);
+
+/** Resume a transfer that its sink paused.
+ *
+ *  With the multi interface, call this from the thread running the event
+ *  loop; the transfer continues right away. A pr_do() transfer may be resumed
+ *  from any thread and continues at its next progress check (at most about a
+ *  second later). A pr_do() sink can also apply backpressure simply by not
+ *  returning until it is ready for more data.
+ */
+void pr_resume(PouchReq *pr);
+
 /** Remove all data from a request's buffer, if it exists */
 PouchReq *pr_clear_data(PouchReq *pr);
+
+/** Empty a request's response buffer. The memory is kept for the next
+ *  response, so a reused PouchReq does not reallocate it for every request.
+ */
+PouchReq *pr_clear_resp(PouchReq *pr);
+
+/** Replace a request's response with a copy of len bytes of data */
+PouchReq *pr_set_resp(PouchReq *pr, const char *data, size_t len);
+
+/** Return the value of response header name, which must be one of the
+ *  X-Couch-* headers (e.g. "X-Couch-Request-ID"), or NULL if it was not sent
+ */
+const char *pr_couch_header(PouchReq *pr, const char *name);
+
+/** Take the response out of a request without copying it.
+ *
+ *  Returns pr->resp.data (NUL terminated, or NULL if there is none) and
+ *  stores its length in *size if size is not NULL. The caller owns the
+ *  buffer and must free() it; pr is left with an empty response.
+ */
+char *pr_take_resp(PouchReq *pr, size_t *size);
+
+/** Set the options common to every request (URL, method, data, headers,
+ *  authentication, callbacks) on a CURL easy handle. Used by pr_do() and
+ *  pr_domulti().
+ */
+void pr_setup_easy(PouchReq *pr, CURL *curl);
+
+/** Perform a request synchronously.
+ *
+ *  The CURL easy handle is kept in pr->easy after the request finishes, so
+ *  reusing the same PouchReq for the next request reuses the open connection
+ *  to the server instead of doing a new TCP (and TLS) handshake.
+ */
 PouchReq *pr_do(PouchReq *pr);
+
+/** Perform n requests at once and return when all of them are done.
+ *
+ *  Up to max_concurrency requests (all of them if it is 0) are in flight at
+ *  a time, driven by a curl multi handle inside the call, with no event loop
+ *  needed. Each request ends up with its response, curlcode and
+ *  httpresponse set just as after pr_do(), and keeps its easy handle for
+ *  the next call. Connections belong to the batch and close when it
+ *  returns, unless the share layer keeps them. Returns 0, or -1 if the
+ *  transfers could not be run.
+ */
+int pr_do_batch(PouchReq **reqs, size_t n, int max_concurrency);
 PouchReq *pr_domulti(PouchReq *pr, CURLM *multi);
 
 /** Free any memory allocated during the creation or processing of a request.
  *  While it is okay to reuse requests, always call this when finished to avoid
- *  leaks.
+ *  leaks. The response buffer is kept in a small process-wide pool, to be
+ *  reused by the next request's response.
  */
 void pr_free(PouchReq *pr);
 
@@ -158,8 +349,8 @@ PouchReq *doc_get_rev(PouchReq *pr, char *server, char *db, char *id, char *rev)
  */
 PouchReq *doc_get_revs(PouchReq *pr, char *server, char *db, char *id);
 
-/** Make a HEAD request, returning basic information about the document,
- *  including its current revision
+/** Make a HEAD request, returning basic information about the document in
+ *  pr->hdrs: its current revision is the ETag, its size the Content-Length
  */
 PouchReq *doc_get_info(PouchReq *pr, char *server, char *db, char *id);
 
@@ -189,23 +380,69 @@ PouchReq *doc_get_attachment(PouchReq *pr, char *server, char *db, char *id, cha
 /** Copy a document from one id to another */
 PouchReq *doc_copy(PouchReq *pr, char *server, char *db, char *id, char *newid, char *revision);
 
-/** Delete a document and all attachments. The revision number is required. */
+/** Delete a document and all attachments. If rev is NULL, the current
+ *  revision is found with doc_get_cur_rev() (which makes a HEAD request
+ *  right away, unless the revision cache has it).
+ */
 PouchReq *doc_delete(PouchReq *pr, char *server, char *db, char *id, char *rev);
 
-/** Upload a file as an attachment to a document */
+/** Replace a document with data, at its current revision as found with
+ *  doc_get_cur_rev(), or create it if it doesn't exist
+ */
+PouchReq *doc_update(PouchReq *pr, char *server, char *db, char *id, char *data);
+
+/** Upload a file as an attachment to a document. Its Content-Type is
+ *  detected with pouch_mime_type_fd().
+ */
 PouchReq *doc_add_attachment(PouchReq *pr, char *server, char *db, char *doc, char *filename);
 
+/** Upload a file as an attachment to revision rev of an existing document
+ *  (or to a new document if rev is NULL). The file is streamed from disk
+ *  when the request is made rather than loaded into memory; it is closed
+ *  when the request's data is replaced or the request is freed.
+ */
+PouchReq *doc_add_attachment_rev(PouchReq *pr, char *server, char *db, char *doc, char *rev, char *filename);
+
+/** Upload length bytes of the open file fd as attachment name of a document,
+ *  at revision rev (NULL for a new document), with the given Content-Type
+ *  (NULL to detect it with pouch_mime_type_fd()). The data is streamed as
+ *  with pr_set_fdata(), and fd still belongs to the caller.
+ */
+PouchReq *doc_add_attachment_fd(PouchReq *pr, char *server, char *db, char *doc, char *rev, char *name, int fd, size_t length, char *content_type);
+
 // Generic curl callback functions
 
 /** Callback used to save CURL requests. Loads the response into
- *  PouchReq* data 
+ *  PouchReq* data. The buffer is sized from the Content-Length when the
+ *  server sends one, and otherwise grows geometrically.
  */
 size_t recv_data_callback(char *ptr, size_t size, size_t nmemb, void *data);
 
+/** Callback that parses response headers into pr->hdrs. Once the headers
+ *  are in, a Content-Length is used to size the response buffer, so it is
+ *  allocated once before the body arrives.
+ */
+size_t recv_header_callback(char *buf, size_t size, size_t nitems, void *data);
+
+/** Progress callback used by pr_do() for requests with a sink. Resumes the
+ *  transfer once pr_resume() has been called.
+ */
+int resume_progress_callback(void *data, curl_off_t dltotal, curl_off_t dlnow, curl_off_t ultotal, curl_off_t ulnow);
+
 /** Callback used to send a CURL request. The JSON string stored in
  *  PouchReq* data is read out and sent.
  */
 size_t send_data_callback(void *ptr, size_t size, size_t nmemb, void *data);
 
+/** Callback used to send data set with pr_set_fdata(), read straight from
+ *  the file with pread()
+ */
+size_t send_fd_callback(char *ptr, size_t size, size_t nmemb, void *data);
+
+/** Seek callback that lets libcurl rewind data set with pr_set_fdata(),
+ *  e.g. to send it again after a redirect
+ */
+int seek_fd_callback(void *data, curl_off_t offset, int origin);
+
 #endif
 
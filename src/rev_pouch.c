@@ -0,0 +1,177 @@
+// Standard libraries
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "rev_pouch.h"
+#include "lru_pouch.h"
+#include "scan_pouch.h"
+
+static PouchLRU *rev_lru = NULL;	// NULL while the cache is off
+
+// Public functions
+int pouch_rev_cache(size_t capacity){
+    if (capacity == 0){
+        capacity = POUCH_REV_CACHE_SIZE;
+    }
+    if (rev_lru){
+        lru_set_budget(rev_lru, capacity);
+        return 0;
+    }
+    rev_lru = lru_new(capacity);	// every revision costs 1
+    return rev_lru ? 0 : -1;
+}
+void pouch_rev_cache_cleanup(void){
+    lru_free(rev_lru);
+    rev_lru = NULL;
+}
+int rev_cache_enabled(void){
+    return rev_lru != NULL;
+}
+static void copy_rev(const char *val, size_t len, void *userp){
+    *(char **)userp = strndup(val, len);
+}
+char *rev_cache_get(const char *url){
+    char *rev = NULL;
+    if (rev_lru){
+        lru_get(rev_lru, url, strlen(url), copy_rev, &rev);
+    }
+    return rev;
+}
+void rev_cache_put(const char *url, const char *rev){
+    if (rev_lru){
+        lru_put(rev_lru, url, strlen(url), rev, strlen(rev), 1);
+    }
+}
+void rev_cache_drop(const char *url){
+    if (rev_lru){
+        lru_drop(rev_lru, url, strlen(url));
+    }
+}
+
+// Finds the document URL a request wrote to, given the document's id: the
+// request's URL up to and including "/id" (attachment URLs go on past it),
+// or the URL plus "/id" for a POST to the database. Returns NULL if the id
+// isn't there.
+static char *written_doc_url(PouchReq *pr, const char *id){
+    size_t id_len = strlen(id);
+    size_t len = strcspn(pr->url, "?");
+    char *url;
+    if (!strcmp(pr->method, POST)){
+        url = (char *)malloc(len + id_len + 2);
+        memcpy(url, pr->url, len);
+        url[len] = '/';
+        memcpy(url + len + 1, id, id_len + 1);
+        return url;
+    }
+    const char *p = pr->url;
+    while ((p = strstr(p, id)) && p < pr->url + len){
+        const char *after = p + id_len;
+        if (p > pr->url && p[-1] == '/' && (after == pr->url + len || *after == '/')){
+            len = after - pr->url;
+            url = (char *)malloc(len + 1);
+            memcpy(url, pr->url, len);
+            url[len] = '\0';
+            return url;
+        }
+        p++;
+    }
+    return NULL;
+}
+void rev_cache_update(PouchReq *pr){
+    int is_delete;
+    if (!rev_lru || !pr->method || !pr->url || pr->sink){
+        return;
+    }
+    is_delete = !strcmp(pr->method, DELETE);
+    if (!is_delete && strcmp(pr->method, PUT) && strcmp(pr->method, POST)){
+        return;
+    }
+    if (pr->httpresponse == 409 || pr->httpresponse == 404){	// our revision was stale
+        char *url = strndup(pr->url, strcspn(pr->url, "?"));
+        rev_cache_drop(url);
+        free(url);
+        return;
+    }
+    if (pr->httpresponse < 200 || pr->httpresponse >= 300 || !pr->resp.data){
+        return;
+    }
+    const char *json = pr->resp.data;
+    if (*json != '{'){	// e.g. the array returned by _bulk_docs
+        return;
+    }
+    char *id = scan_member_dup(json, pr->resp.size, "id");
+    char *rev = scan_member_dup(json, pr->resp.size, "rev");
+    char *url = id && rev ? written_doc_url(pr, id) : NULL;
+    if (url){
+        // an attachment delete leaves the document in place
+        if (is_delete && strlen(url) == strcspn(pr->url, "?")){
+            rev_cache_drop(url);
+        } else {
+            rev_cache_put(url, rev);
+        }
+    }
+    free(url);
+    free(id);
+    free(rev);
+}
+long rev_cache_prefetch(PouchReq *pr, char *server, char *db, char **ids, size_t n){
+    size_t i, len, prefix_len;
+    long cached = 0;
+    if (!rev_lru){
+        return 0;
+    }
+    // {"keys":[...]}
+    char **quoted = (char **)malloc((n + 1)*sizeof(char *));
+    size_t body_len = sizeof("{\"keys\":[]}");
+    for (i = 0; i < n; i++){
+        quoted[i] = scan_quote(ids[i]);
+        body_len += strlen(quoted[i]) + 1;
+    }
+    char *body = (char *)malloc(body_len);
+    char *b = body + sprintf(body, "{\"keys\":[");
+    for (i = 0; i < n; i++){
+        b += sprintf(b, i ? ",%s" : "%s", quoted[i]);
+        free(quoted[i]);
+    }
+    b += sprintf(b, "]}");
+    free(quoted);
+    pr = get_all_docs(pr, server, db);
+    pr_set_method(pr, POST);
+    pr_set_prdata(pr, body, b - body);
+    pr_do(pr);
+    if (pr->curlcode != CURLE_OK || pr->httpresponse != 200){
+        return -1;
+    }
+
+    // cache each row's value.rev under server/db/id
+    char *url = NULL;
+    url = combine(&url, server, db, "/");
+    prefix_len = strlen(url);
+    const char *end = pr->resp.data + pr->resp.size;
+    const char *rows = scan_member(pr->resp.data, end, "rows", &len);
+    const char *row = NULL;
+    size_t row_len, value_len;
+    while (rows && (row = scan_element(rows, rows + len, row, &row_len))){
+        const char *value = scan_member(row, row + row_len, "value", &value_len);
+        char *id = scan_member_dup(row, row_len, "id");
+        char *rev = value ? scan_member_dup(value, value_len, "rev") : NULL;
+        // skip missing (no id) and deleted documents
+        size_t deleted_len;
+        const char *deleted = value ? scan_member(value, value + value_len, "deleted", &deleted_len) : NULL;
+        if (id && rev && !(deleted && !strncmp(deleted, "true", 4))){
+            size_t id_len = strlen(id);
+            char *doc_url = (char *)malloc(prefix_len + id_len + 2);
+            memcpy(doc_url, url, prefix_len);
+            doc_url[prefix_len] = '/';
+            memcpy(doc_url + prefix_len + 1, id, id_len + 1);
+            lru_put(rev_lru, doc_url, prefix_len + id_len + 1, rev, strlen(rev), 1);
+            free(doc_url);
+            cached++;
+        }
+        free(id);
+        free(rev);
+    }
+    free(url);
+    return cached;
+}
@@ -0,0 +1,64 @@
+#ifndef __REV_POUCH_H__
+#define __REV_POUCH_H__
+
+// Standard libraries
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+// Pouch helpers
+#include "pouch.h"
+
+/*
+ * Process-wide cache of the current revisions of documents, keyed by the
+ * document's URL (server/db/id, as built by the doc_ wrappers). It is fed
+ * by the responses to document writes made with pr_do() or the multi
+ * interface, and by PouchBulk results, so updating or deleting a document
+ * this process wrote recently needs no HEAD request to find its revision.
+ *
+ * Another client may change a document behind the cache's back. A write
+ * that fails with a conflict drops the document's entry, so the next
+ * doc_get_cur_rev() asks the server again.
+ */
+
+#define POUCH_REV_CACHE_SIZE 10000	// documents remembered by default
+
+/** Turn on the revision cache, keeping the capacity most recently used
+ *  revisions (0 for POUCH_REV_CACHE_SIZE). Call it again to change the
+ *  capacity, or pouch_rev_cache_cleanup() to turn the cache off. Returns 0,
+ *  or -1 if out of memory.
+ */
+int pouch_rev_cache(size_t capacity);
+
+/** Turn off the revision cache and free it. Call it only while no requests
+ *  are running.
+ */
+void pouch_rev_cache_cleanup(void);
+
+/** Whether the revision cache is on */
+int rev_cache_enabled(void);
+
+/** Look up the cached revision of the document at url. Returns a copy that
+ *  must be free()d, or NULL.
+ */
+char *rev_cache_get(const char *url);
+
+/** Remember rev as the current revision of the document at url */
+void rev_cache_put(const char *url, const char *rev);
+
+/** Forget the revision of the document at url */
+void rev_cache_drop(const char *url);
+
+/** Update the cache from a finished request: the rev in the response to a
+ *  document PUT, POST or DELETE is stored (deletes and conflicts drop the
+ *  entry instead). Called by pr_do() and check_multi_info().
+ */
+void rev_cache_update(PouchReq *pr);
+
+/** Fill the cache with the current revisions of n documents of db, with one
+ *  POST to _all_docs with keys. Returns the number of revisions cached, or
+ *  -1 if the request failed.
+ */
+long rev_cache_prefetch(PouchReq *pr, char *server, char *db, char **ids, size_t n);
+
+#endif
@@ -0,0 +1,383 @@
+// Standard libraries
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <ctype.h>
+
+#include "scan_pouch.h"
+
+#define is_space(c) ((c) == ' ' || (c) == '\t' || (c) == '\n' || (c) == '\r')
+#define is_literal(c) (isalnum((unsigned char)(c)) || (c) == '-' || (c) == '+' || (c) == '.')
+
+// Whole values
+static const char *skip_space(const char *p, const char *end){
+    while (p < end && is_space(*p)){
+        p++;
+    }
+    return p;
+}
+const char *scan_skip(const char *json, const char *end){
+    const char *p = skip_space(json, end);
+    int nest = 0;
+    if (p >= end){
+        return NULL;
+    }
+    if (*p == '"' || *p == '{' || *p == '['){
+        int in_string = 0;
+        for (; p < end; p++){
+            if (in_string){
+                if (*p == '\\'){
+                    p++;	// skip the escaped character
+                } else if (*p == '"'){
+                    in_string = 0;
+                    if (nest == 0){	// the value was a string
+                        return p + 1;
+                    }
+                }
+            } else if (*p == '"'){
+                in_string = 1;
+            } else if (*p == '{' || *p == '['){
+                nest++;
+            } else if ((*p == '}' || *p == ']') && --nest == 0){
+                return p + 1;
+            }
+        }
+        return NULL;	// the value did not end
+    }
+    json = p;
+    while (p < end && is_literal(*p)){	// number, true, false or null
+        p++;
+    }
+    return p > json ? p : NULL;
+}
+const char *scan_member(const char *json, const char *end, const char *key, size_t *len){
+    size_t key_len = strlen(key);
+    const char *p = skip_space(json, end);
+    if (p >= end || *p != '{'){
+        return NULL;
+    }
+    p = skip_space(p + 1, end);
+    while (p < end && *p == '"'){
+        const char *name = p + 1;
+        const char *name_end = scan_skip(p, end);
+        if (!name_end){
+            return NULL;
+        }
+        p = skip_space(name_end, end);
+        if (p >= end || *p != ':'){
+            return NULL;
+        }
+        const char *val = skip_space(p + 1, end);
+        const char *val_end = scan_skip(val, end);
+        if (!val_end){
+            return NULL;
+        }
+        if ((size_t)(name_end - name - 1) == key_len && !strncmp(name, key, key_len)){
+            if (len){
+                *len = val_end - val;
+            }
+            return val;
+        }
+        p = skip_space(val_end, end);
+        if (p >= end || *p != ','){
+            return NULL;	// '}', or broken JSON
+        }
+        p = skip_space(p + 1, end);
+    }
+    return NULL;
+}
+const char *scan_element(const char *json, const char *end, const char *prev, size_t *len){
+    const char *p;
+    if (!prev){
+        p = skip_space(json, end);
+        if (p >= end || *p != '['){
+            return NULL;
+        }
+        p = skip_space(p + 1, end);
+        if (p >= end || *p == ']'){
+            return NULL;
+        }
+    } else {
+        p = scan_skip(prev, end);
+        if (!p){
+            return NULL;
+        }
+        p = skip_space(p, end);
+        if (p >= end || *p != ','){
+            return NULL;
+        }
+        p = skip_space(p + 1, end);
+    }
+    const char *val_end = scan_skip(p, end);
+    if (!val_end){
+        return NULL;
+    }
+    if (len){
+        *len = val_end - p;
+    }
+    return p;
+}
+
+// writes unicode as UTF-8 to out, returning the number of bytes written
+static int put_utf8(unsigned long unicode, char *out){
+    if (unicode < 0x80){
+        out[0] = unicode;
+        return 1;
+    } else if (unicode < 0x800){
+        out[0] = 0xC0 | (unicode >> 6);
+        out[1] = 0x80 | (unicode & 0x3F);
+        return 2;
+    } else if (unicode < 0x10000){
+        out[0] = 0xE0 | (unicode >> 12);
+        out[1] = 0x80 | ((unicode >> 6) & 0x3F);
+        out[2] = 0x80 | (unicode & 0x3F);
+        return 3;
+    }
+    out[0] = 0xF0 | (unicode >> 18);
+    out[1] = 0x80 | ((unicode >> 12) & 0x3F);
+    out[2] = 0x80 | ((unicode >> 6) & 0x3F);
+    out[3] = 0x80 | (unicode & 0x3F);
+    return 4;
+}
+static unsigned long read_hex16(const char *p, const char *end){
+    char hex[5];
+    if (end - p < 4){
+        return 0;
+    }
+    memcpy(hex, p, 4);
+    hex[4] = '\0';
+    return strtoul(hex, NULL, 16);
+}
+char *scan_strdup(const char *val, size_t len){
+    const char *end = val + len;
+    char *out = (char *)malloc(len + 1);	// unescaping never grows a string
+    char *o = out;
+    if (!out){
+        return NULL;
+    }
+    if (len < 2 || *val != '"'){	// not a string: copy the JSON text
+        memcpy(out, val, len);
+        out[len] = '\0';
+        return out;
+    }
+    const char *p;
+    for (p = val + 1; p < end - 1; p++){
+        if (*p != '\\'){
+            *o++ = *p;
+            continue;
+        }
+        p++;
+        switch (*p){
+            case 'b': *o++ = '\b'; break;
+            case 'f': *o++ = '\f'; break;
+            case 'n': *o++ = '\n'; break;
+            case 'r': *o++ = '\r'; break;
+            case 't': *o++ = '\t'; break;
+            case 'u': {
+                unsigned long unicode = read_hex16(p + 1, end);
+                p += 4;
+                if (unicode >= 0xD800 && unicode <= 0xDBFF && end - p > 6 && p[1] == '\\' && p[2] == 'u'){
+                    unsigned long low = read_hex16(p + 3, end);	// surrogate pair
+                    unicode = 0x10000 + ((unicode - 0xD800) << 10) + (low - 0xDC00);
+                    p += 6;
+                }
+                o += put_utf8(unicode, o);
+                break;
+            }
+            default:	// '"', '\\' and '/'
+                *o++ = *p;
+        }
+    }
+    *o = '\0';
+    return out;
+}
+char *scan_member_dup(const char *json, size_t len, const char *key){
+    size_t val_len;
+    const char *val = scan_member(json, json + len, key, &val_len);
+    if (!val || (val_len == 4 && !strncmp(val, "null", 4))){
+        return NULL;
+    }
+    return scan_strdup(val, val_len);
+}
+
+char *scan_quote(const char *str){
+    static const char hex[] = "0123456789abcdef";
+    char *out = (char *)malloc(6*strlen(str) + 3);	// every byte could become \u00XX
+    char *o = out;
+    if (!out){
+        return NULL;
+    }
+    *o++ = '"';
+    for (; *str; str++){
+        unsigned char c = *str;
+        if (c == '"' || c == '\\'){
+            *o++ = '\\';
+            *o++ = c;
+        } else if (c < 0x20){
+            memcpy(o, "\\u00", 4);
+            o[4] = hex[c >> 4];
+            o[5] = hex[c & 0xF];
+            o += 6;
+        } else {
+            *o++ = c;
+        }
+    }
+    *o++ = '"';
+    *o = '\0';
+    return out;
+}
+
+// Streams
+void scan_init(ScanStream *ss, int emit_depth, scan_value_cb cb, void *userp){
+    memset(ss, 0, sizeof(*ss));
+    ss->cb = cb;
+    ss->userp = userp;
+    ss->emit_depth = emit_depth;
+}
+void scan_reset(ScanStream *ss){
+    free(ss->buf);
+    scan_init(ss, ss->emit_depth, ss->cb, ss->userp);
+}
+static void scan_put(ScanStream *ss, char c){
+    if (ss->len + 1 >= ss->alloc){	// leave room for a '\0'
+        size_t alloc = ss->alloc ? 2*ss->alloc : 256;
+        char *buf = (char *)realloc(ss->buf, alloc);
+        if (!buf){
+            ss->failed = 1;
+            return;
+        }
+        ss->buf = buf;
+        ss->alloc = alloc;
+    }
+    ss->buf[ss->len++] = c;
+}
+static void scan_emit(ScanStream *ss){
+    const char *key = NULL;
+    if (ss->depth > 0 && ss->types[ss->depth - 1] == '{'){
+        key = ss->key;
+    }
+    ss->buf[ss->len] = '\0';
+    if (ss->cb(ss, key, ss->depth, ss->buf, ss->len, ss->userp)){
+        ss->failed = 1;
+    }
+    ss->len = 0;
+    ss->collecting = 0;
+}
+int scan_feed(ScanStream *ss, const char *data, size_t len){
+    const char *p = data;
+    const char *end = data + len;
+    while (p < end && !ss->failed){
+        char c = *p;
+        switch (ss->collecting){
+            case 'l':	// a literal ends at the first character not part of it
+                if (is_literal(c)){
+                    scan_put(ss, c);
+                    p++;
+                    continue;
+                }
+                scan_emit(ss);
+                continue;	// c still needs handling
+            case 'k':	// member name
+                if (ss->escape){
+                    ss->escape = 0;
+                } else if (c == '\\'){
+                    ss->escape = 1;
+                } else if (c == '"'){
+                    ss->key[ss->key_len] = '\0';
+                    ss->collecting = 0;
+                    ss->expect_key = 0;
+                    p++;
+                    continue;
+                }
+                if (ss->key_len < SCAN_MAX_KEY - 1){
+                    ss->key[ss->key_len++] = c;
+                }
+                p++;
+                continue;
+            case '"':	// string value
+                scan_put(ss, c);
+                if (ss->escape){
+                    ss->escape = 0;
+                } else if (c == '\\'){
+                    ss->escape = 1;
+                } else if (c == '"'){
+                    scan_emit(ss);
+                }
+                p++;
+                continue;
+            case '{':	// object or array at emit_depth
+                scan_put(ss, c);
+                if (ss->in_string){
+                    if (ss->escape){
+                        ss->escape = 0;
+                    } else if (c == '\\'){
+                        ss->escape = 1;
+                    } else if (c == '"'){
+                        ss->in_string = 0;
+                    }
+                } else if (c == '"'){
+                    ss->in_string = 1;
+                } else if (c == '{' || c == '['){
+                    ss->nest++;
+                } else if ((c == '}' || c == ']') && --ss->nest == 0){
+                    scan_emit(ss);
+                }
+                p++;
+                continue;
+        }
+        // between values
+        p++;
+        if (is_space(c)){
+            continue;
+        }
+        switch (c){
+            case '{':
+            case '[':
+                if (ss->depth >= ss->emit_depth){	// collect it whole
+                    ss->collecting = '{';
+                    ss->nest = 1;
+                    ss->in_string = ss->escape = 0;
+                    scan_put(ss, c);
+                } else if (ss->depth < SCAN_MAX_DEPTH){
+                    ss->types[ss->depth++] = c;
+                    ss->expect_key = (c == '{');
+                } else {
+                    ss->failed = 1;
+                }
+                break;
+            case '}':
+            case ']':
+                if (ss->depth == 0 || ss->types[ss->depth - 1] != (c == '}' ? '{' : '[')){
+                    ss->failed = 1;
+                    break;
+                }
+                ss->depth--;
+                ss->expect_key = 0;
+                break;
+            case ':':
+                ss->expect_key = 0;
+                break;
+            case ',':
+                ss->expect_key = (ss->depth > 0 && ss->types[ss->depth - 1] == '{');
+                break;
+            case '"':
+                ss->escape = 0;
+                if (ss->expect_key){
+                    ss->key_len = 0;
+                    ss->collecting = 'k';
+                } else {
+                    ss->collecting = '"';
+                    scan_put(ss, c);
+                }
+                break;
+            default:
+                if (!is_literal(c)){
+                    ss->failed = 1;
+                    break;
+                }
+                ss->collecting = 'l';
+                scan_put(ss, c);
+        }
+    }
+    return ss->failed ? -1 : 0;
+}
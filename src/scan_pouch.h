@@ -0,0 +1,104 @@
+#ifndef __SCAN_POUCH_H__
+#define __SCAN_POUCH_H__
+
+// Standard libraries
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+/*
+ * Minimal JSON scanning used internally by pouch to pick fields such as
+ * "id", "rev" and "seq" out of CouchDB responses. pouch does not depend on a
+ * JSON library, so these only find and copy values; parse documents with the
+ * JSON library of your choice.
+ */
+
+// Structs
+typedef struct _ScanStream ScanStream;
+
+/** scan_value_cb
+ *
+ *  Called by a ScanStream for every complete value it finds. key is the name
+ *  of the member the value belongs to (NULL in arrays and at the top level),
+ *  depth its nesting depth (0 for top-level values) and val/len its JSON
+ *  text, which is NUL terminated. Return nonzero to stop scanning.
+ */
+typedef int (*scan_value_cb)(ScanStream *ss, const char *key, int depth, const char *val, size_t len, void *userp);
+
+#define SCAN_MAX_DEPTH 16	// deepest nesting a ScanStream keeps track of
+#define SCAN_MAX_KEY 64		// longer member names are cut short
+
+/** _ScanStream
+ *
+ *  Splits JSON that arrives in pieces into values, without building a tree.
+ *  Values nested emit_depth deep are collected whole and handed to the
+ *  callback; shallower objects and arrays are only descended into, although
+ *  their scalar members are handed over as well. Several top-level values
+ *  may follow each other, as in a continuous _changes feed.
+ */
+struct _ScanStream {
+    scan_value_cb cb;		// called for every value found
+    void *userp;			// USER DEFINED pointer passed to cb
+    int emit_depth;			// values at this depth are collected whole
+    int depth;				// current nesting depth
+    char types[SCAN_MAX_DEPTH];	// '{' or '[' for each open container
+    char key[SCAN_MAX_KEY];	// name of the most recent member
+    int key_len;			// ... length of key
+    int expect_key;			// the next string is a member name
+    int collecting;			// what is being read: 0, 'k' (a member name),
+                            // '"' (a string), 'l' (other scalars) or '{'
+                            // (an object or array at emit_depth)
+    int nest;				// nesting inside a collected container
+    int in_string;			// inside a string
+    int escape;				// previous character was a backslash
+    int failed;				// invalid JSON, or cb asked to stop
+    char *buf;				// text of the value being collected
+    size_t len;				// ... bytes in buf
+    size_t alloc;			// ... bytes allocated for buf
+};
+
+/** Initialize a ScanStream. Call scan_reset() when done with it. */
+void scan_init(ScanStream *ss, int emit_depth, scan_value_cb cb, void *userp);
+
+/** Feed the next piece of JSON to a ScanStream. Returns 0, or -1 if the
+ *  JSON is invalid or the callback asked to stop.
+ */
+int scan_feed(ScanStream *ss, const char *data, size_t len);
+
+/** Forget any partial input and free the stream's buffer */
+void scan_reset(ScanStream *ss);
+
+/** Return a pointer just past the JSON value that starts at json (leading
+ *  whitespace is skipped), or NULL if it does not end before end.
+ */
+const char *scan_skip(const char *json, const char *end);
+
+/** Find member key of the JSON object that starts at json. Returns a pointer
+ *  to its value and stores the value's length in *len, or returns NULL.
+ */
+const char *scan_member(const char *json, const char *end, const char *key, size_t *len);
+
+/** Copy a value found with scan_member() into a new NUL terminated string.
+ *  Strings are unescaped (\uXXXX escapes are written as UTF-8); anything
+ *  else is copied as JSON text. The result must be free()d.
+ */
+char *scan_strdup(const char *val, size_t len);
+
+/** Copy member key of the JSON object at json, as scan_strdup() does.
+ *  Returns NULL if there is no such member or it is null.
+ */
+char *scan_member_dup(const char *json, size_t len, const char *key);
+
+/** Write str as a JSON string, quotes included, into a new string that
+ *  must be free()d
+ */
+char *scan_quote(const char *str);
+
+/** Walk the elements of the JSON array that starts at json. Pass NULL as
+ *  prev to get the first element and the previous element to get the next.
+ *  Returns NULL after the last element; the element's length is stored in
+ *  *len.
+ */
+const char *scan_element(const char *json, const char *end, const char *prev, size_t *len);
+
+#endif
@@ -0,0 +1,285 @@
+// Standard libraries
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "session_pouch.h"
+#include "scan_pouch.h"
+
+#define COOKIE_NAME "AuthSession="
+
+/** PouchSession
+ *
+ *  The process-wide session. gen counts logins, so that a pile of requests
+ *  turned away with the same stale cookie log in again only once.
+ */
+typedef struct {
+    char *server;		// requests to URLs starting with this use the cookie
+    char *url;			// server's /_session, which the login is sent to
+    char *login;		// JSON body of the POST to /_session
+    char *cookie;		// "AuthSession=...", or NULL if not logged in
+    time_t since;		// when cookie was issued
+    int gen;			// bumped by every login
+} PouchSession;
+
+static PouchSession *session = NULL;
+static pthread_mutex_t session_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static size_t discard(char *ptr, size_t size, size_t nmemb, void *data){
+    return size*nmemb;
+}
+static double seconds_since(time_t t){
+    return difftime(time(NULL), t);
+}
+
+// keeps the AuthSession cookie from a Set-Cookie value, if there is one;
+// returns 1 if it was kept. Called with the lock held.
+static int take_cookie(const char *set_cookie){
+    if (strncmp(set_cookie, COOKIE_NAME, strlen(COOKIE_NAME))){
+        return 0;
+    }
+    size_t len = strcspn(set_cookie, ";");
+    if (len == strlen(COOKIE_NAME)){	// an emptied cookie: logged out
+        return 0;
+    }
+    free(session->cookie);
+    session->cookie = strndup(set_cookie, len);
+    session->since = time(NULL);
+    return session->cookie != NULL;
+}
+
+// takes the AuthSession cookie from any Set-Cookie headers of the login
+// request, which is not a PouchReq. Called with the lock held.
+static int take_cookies(CURL *easy){
+    struct curl_header *h;
+    size_t i = 0, amount = 1;
+    int found = 0;
+    while (i < amount && curl_easy_header(easy, "Set-Cookie", i, CURLH_HEADER, -1, &h) == CURLHE_OK){
+        amount = h->amount;
+        found |= take_cookie(h->value);
+        i++;
+    }
+    return found;
+}
+
+// whether pr goes to the session's server and should carry its cookie;
+// the login itself never does. Called with the lock held.
+static int uses_session(PouchReq *pr){
+    return session && !pr->usrpwd &&
+        !strncmp(pr->url, session->server, strlen(session->server)) &&
+        strcmp(pr->url, session->url);
+}
+
+// logs in with a request of its own (pr_do() would come back to
+// session_prepare()). Returns 0 or the HTTP status. Called with the lock
+// held, so that other threads wait for the new cookie instead of logging in
+// as well.
+static long login_locked(void){
+    long code = -1;
+    struct curl_slist *headers = NULL;
+    CURL *easy = curl_easy_init();
+    if (!easy){
+        return -1;
+    }
+    headers = curl_slist_append(headers, "Content-Type: application/json");
+    curl_easy_setopt(easy, CURLOPT_URL, session->url);
+    curl_easy_setopt(easy, CURLOPT_POSTFIELDS, session->login);
+    curl_easy_setopt(easy, CURLOPT_HTTPHEADER, headers);
+    curl_easy_setopt(easy, CURLOPT_NOSIGNAL, 1L);
+    curl_easy_setopt(easy, CURLOPT_CONNECTTIMEOUT, 2);
+    curl_easy_setopt(easy, CURLOPT_TIMEOUT, 60);
+    curl_easy_setopt(easy, CURLOPT_WRITEFUNCTION, discard);
+    free(session->cookie);
+    session->cookie = NULL;
+    session->gen++;
+    if (curl_easy_perform(easy) == CURLE_OK){
+        curl_easy_getinfo(easy, CURLINFO_RESPONSE_CODE, &code);
+        if (code == 200 && take_cookies(easy)){
+            code = 0;
+        } else if (code == 200){	// logged in, but no cookie to use
+            code = 500;
+        }
+    }
+    if (code){
+        fprintf(stderr, "pouch_session_login: could not log in to %s (%ld)\n",
+                session->server, code);
+    }
+    curl_slist_free_all(headers);
+    curl_easy_cleanup(easy);
+    return code;
+}
+
+long pouch_session_login(char *server, char *user, char *password){
+    char *name = scan_quote(user);
+    char *pass = scan_quote(password);
+    long code;
+    pthread_mutex_lock(&session_lock);
+    if (!session){
+        session = (PouchSession *)calloc(1, sizeof(PouchSession));
+    } else {
+        free(session->server);
+        free(session->url);
+        free(session->login);
+    }
+    session->server = strdup(server);
+    session->url = NULL;
+    session->url = combine(&session->url, session->server, "_session", "/");
+    size_t len = strlen(name) + strlen(pass) + sizeof("{\"name\":,\"password\":}");
+    session->login = (char *)malloc(len);
+    snprintf(session->login, len, "{\"name\":%s,\"password\":%s}", name, pass);
+    code = login_locked();
+    pthread_mutex_unlock(&session_lock);
+    free(name);
+    free(pass);
+    return code;
+}
+void pouch_session_logout(void){
+    if (!session){
+        return;
+    }
+    if (session->cookie){
+        PouchReq *pr = pr_init();
+        pr_set_method(pr, DELETE);
+        pr_set_url(pr, session->url);
+        char *cookie = NULL;
+        cookie = combine(&cookie, "Cookie:", session->cookie, " ");
+        pr_add_header(pr, cookie);	// session_prepare() leaves /_session alone
+        free(cookie);
+        pr_do(pr);
+        pr_free(pr);
+    }
+    free(session->server);
+    free(session->url);
+    free(session->login);
+    free(session->cookie);
+    free(session);
+    session = NULL;
+}
+
+void session_prepare(PouchReq *pr, CURL *curl){
+    pr->session = 0;
+    if (!session){
+        return;
+    }
+    pthread_mutex_lock(&session_lock);
+    if (!uses_session(pr)){
+        pthread_mutex_unlock(&session_lock);
+        return;
+    }
+    // a PouchMInfo logs in with a request of its own (session_login_request),
+    // so that its event loop never waits for the server
+    if (!pr->multi && (!session->cookie || seconds_since(session->since) > POUCH_SESSION_REFRESH)){
+        login_locked();
+    }
+    if (session->cookie){
+        curl_easy_setopt(curl, CURLOPT_COOKIE, session->cookie);	// copied by libcurl
+        pr->session = session->gen;
+    }
+    pthread_mutex_unlock(&session_lock);
+}
+void session_finish(PouchReq *pr){
+    if (!pr->session || !session){
+        return;
+    }
+    if (!pr->hdrs.auth_session){
+        return;
+    }
+    pthread_mutex_lock(&session_lock);
+    take_cookie(pr->hdrs.auth_session);
+    pthread_mutex_unlock(&session_lock);
+}
+int session_retry(PouchReq *pr){
+    long code = 0;
+    if (pr->session <= 0 || pr->sink || !session){
+        return 0;
+    }
+    curl_easy_getinfo(pr->easy, CURLINFO_RESPONSE_CODE, &code);
+    if (code != 401){
+        return 0;
+    }
+    pthread_mutex_lock(&session_lock);
+    if (session->gen == pr->session){	// nobody has logged in again yet
+        login_locked();
+    }
+    if (session->cookie){
+        curl_easy_setopt(pr->easy, CURLOPT_COOKIE, session->cookie);
+    }
+    pthread_mutex_unlock(&session_lock);
+    pr->session = -1;	// only once
+    pr->req.fd_pos = pr->req.fd_start;	// send any file from the start again
+    pr_clear_resp(pr);
+    return 1;
+}
+
+int session_needs_login(PouchReq *pr){
+    int needs = 0;
+    if (!session){
+        return 0;
+    }
+    pthread_mutex_lock(&session_lock);
+    if (uses_session(pr)){
+        needs = !session->cookie || seconds_since(session->since) > POUCH_SESSION_REFRESH;
+    }
+    pthread_mutex_unlock(&session_lock);
+    return needs;
+}
+PouchReq *session_login_request(PouchReq *pr){
+    if (!session){
+        return NULL;
+    }
+    pthread_mutex_lock(&session_lock);
+    pr_set_method(pr, POST);
+    pr_set_url(pr, session->url);
+    pr_set_data(pr, session->login);
+    pthread_mutex_unlock(&session_lock);
+    return pr;
+}
+long session_login_finish(PouchReq *pr){
+    long code = pr->curlcode == CURLE_OK ? pr->httpresponse : -1;
+    if (!session){
+        return -1;
+    }
+    pthread_mutex_lock(&session_lock);
+    if (code == 200 && pr->hdrs.auth_session && take_cookie(pr->hdrs.auth_session)){
+        session->gen++;
+        code = 0;
+    } else if (code == 200){	// logged in, but no cookie to use
+        code = 500;
+    }
+    if (code){
+        fprintf(stderr, "pouch_session_login: could not log in to %s (%ld)\n",
+                session->server, code);
+    }
+    pthread_mutex_unlock(&session_lock);
+    return code;
+}
+int session_expired(PouchReq *pr){
+    long code = 0;
+    int gen = pr->session;
+    if (pr->session <= 0 || pr->sink || !session){
+        return 0;
+    }
+    curl_easy_getinfo(pr->easy, CURLINFO_RESPONSE_CODE, &code);
+    if (code != 401){
+        return 0;
+    }
+    pr->session = -1;	// only once
+    pr->req.fd_pos = pr->req.fd_start;	// send any file from the start again
+    pr_clear_resp(pr);
+    return gen;
+}
+int session_resend_cookie(PouchReq *pr, int gen){
+    int renewed = 0;
+    if (!session){
+        return 0;
+    }
+    pthread_mutex_lock(&session_lock);
+    if (session->cookie && session->gen != gen){
+        curl_easy_setopt(pr->easy, CURLOPT_COOKIE, session->cookie);
+        renewed = 1;
+    }
+    pthread_mutex_unlock(&session_lock);
+    return renewed;
+}
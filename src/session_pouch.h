@@ -0,0 +1,94 @@
+#ifndef __SESSION_POUCH_H__
+#define __SESSION_POUCH_H__
+
+// Standard libraries
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+// Pouch helpers
+#include "pouch.h"
+
+/*
+ * Cookie authentication. Instead of sending a password with every request
+ * (which CouchDB has to hash every time), pouch logs in once with
+ * POST /_session and sends the AuthSession cookie it gets back with every
+ * request to that server, from pr_do() and from a PouchMInfo alike.
+ *
+ * Cookies CouchDB renews along the way are picked up from the responses; a
+ * cookie older than POUCH_SESSION_REFRESH seconds is renewed by logging in
+ * again before it is used, and a request turned away with 401 Unauthorized
+ * logs in again and is sent once more (unless it has a sink, which may
+ * already have seen the 401). Requests with their own pr_add_usrpwd()
+ * credentials are left alone.
+ *
+ * pr_do() and pr_do_batch() log in again with a blocking POST while holding
+ * the session's lock, so other threads that need the session wait for the
+ * new cookie (up to a minute if the server does not answer). A PouchMInfo
+ * never blocks: it sends the POST as one of its own requests and holds the
+ * requests that need the new cookie until the login finishes.
+ */
+
+#define POUCH_SESSION_REFRESH 540	// seconds; CouchDB's default timeout is 600
+
+/** Log in to server as user and use the session for all requests to it from
+ *  now on. Returns 0, or the HTTP status of the failed login (or -1 if the
+ *  server could not be reached).
+ */
+long pouch_session_login(char *server, char *user, char *password);
+
+/** Log out with DELETE /_session and stop using the session. Call it only
+ *  while no requests are running.
+ */
+void pouch_session_logout(void);
+
+/** Send the session cookie with a request to the session's server. Called
+ *  by pr_setup_easy(). Outside a PouchMInfo (pr->multi unset), a missing or
+ *  old cookie is renewed first, blocking until the login is done.
+ */
+void session_prepare(PouchReq *pr, CURL *curl);
+
+/** Pick up a renewed cookie from a response. Called by pr_do() and
+ *  check_multi_info().
+ */
+void session_finish(PouchReq *pr);
+
+/** If a request sent with the cookie got 401 Unauthorized, log in again,
+ *  put the new cookie on the request and return 1 so that it is sent again.
+ *  Returns 0 otherwise. Blocks for the login; used by pr_do() and
+ *  pr_do_batch(), not by a PouchMInfo.
+ */
+int session_retry(PouchReq *pr);
+
+// Non-blocking logins, for the multi interface
+
+/** Whether pr goes to the session's server and the cookie is missing or old
+ *  enough to be renewed before pr is sent
+ */
+int session_needs_login(PouchReq *pr);
+
+/** Make pr the POST /_session that logs in again; send it like any request
+ *  and pass it to session_login_finish() once done. Returns NULL if there is
+ *  no session.
+ */
+PouchReq *session_login_request(PouchReq *pr);
+
+/** Keep the cookie a session_login_request() came back with. Returns 0, or
+ *  the HTTP status of the failed login (-1 if the server was not reached).
+ */
+long session_login_finish(PouchReq *pr);
+
+/** Like session_retry(), but without logging in: if pr was turned away with
+ *  401 Unauthorized, get it ready to be sent again and return the login its
+ *  cookie came from, to pass to session_resend_cookie(). Returns 0 if pr is
+ *  done.
+ */
+int session_expired(PouchReq *pr);
+
+/** Put the session's cookie on pr's easy handle if it comes from a login
+ *  other than gen (-1 for any). Returns 1 if it did, 0 if pr has to wait for
+ *  a new login.
+ */
+int session_resend_cookie(PouchReq *pr, int gen);
+
+#endif